@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Engine benchmark matrix. Runs the simulator over a fixed set of
+# configurations, each for a fixed slot horizon with a fixed seed, and
+# prints the wall time of every run along with the total. The same matrix
+# is the training run of the profile-guided build.
+#
+# usage: bench/matrix.sh [simulator] [slots]
+#
+
+SIM=${1:-./Simulation}
+SLOTS=${2:-2000000}
+
+# <pkt-size> <node-count> <cw-size> [options]
+MATRIX="
+1 10 16
+10 10 32
+10 60 16
+10 1000 64
+50 200 64
+100 50 32
+100 50 32 --policy reset
+7 300 100
+1 2000 256
+10 1000 64 --approx
+100 50 32 --parareal 4
+"
+
+now () {
+    date +%s%N
+}
+
+echo "$SIM, $SLOTS slots"
+total=0
+while read -r args; do
+    [ -z "$args" ] && continue
+    start=$(now)
+    $SIM $args --fixed -S "$SLOTS" -s 1 > /dev/null || exit 1
+    ms=$(( ($(now) - start) / 1000000 ))
+    total=$((total + ms))
+    printf "  %-34s %8d ms\n" "$args" "$ms"
+done <<EOF
+$MATRIX
+EOF
+printf "  %-34s %8d ms\n" "total" "$total"
@@ -3,251 +3,6870 @@
  * of the 802.11 MAC protocol for Wireless Networks
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
 #include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
 
 /* Defines */
 
 #define MAX_SLOT_SIZE           100000
 #define MAX_PKT_SIZE            100
-#define MAX_NODE_COUNT          1000
+#define MAX_NODE_COUNT          10000000
 #define MAX_CW_SIZE             512
 
+/*
+ * The CW stops doubling once it reaches this size. Without the cap a node
+ * that keeps colliding in a long run would overflow cw_size.
+ */
+#define MAX_BACKOFF_CW          (1 << 30)
+#define MAX_BACKOFF_STAGE       32
+
 #define SLOT_STATE_IDLE         0
 #define SLOT_STATE_TRANSMISSION 1
 #define SLOT_STATE_COLLISION    2
+#define SLOT_STATE_MANAGEMENT   3
+#define SLOT_STATE_SIFS         4       /* Gap within a TXOP */
 
 #define INVALID_BACKOFF        -1
 
+/*
+ * Slot states are packed SLOTS_PER_WORD to a word, SLOT_STATE_BITS each.
+ * Per-node flags are kept as bitsets of NODES_PER_WORD nodes per word.
+ *
+ * Only the slots from the current one up to the end of the longest
+ * transmission matter, so slot states live in a ring of SLOT_RING_WORDS
+ * words that is recycled as the run advances.
+ */
+#define SLOT_STATE_BITS         4
+#define SLOT_STATE_MASK         ((1 << SLOT_STATE_BITS) - 1)
+#define SLOTS_PER_WORD          16
+#define SLOT_RING_WORDS         128
+#define SLOT_RING_SIZE          (SLOT_RING_WORDS * SLOTS_PER_WORD)
+
+/*
+ * Longest transmission the ring can hold ahead of the current slot, which
+ * is in a word that hasn't been recycled yet
+ */
+#define MAX_TX_SLOTS            (SLOT_RING_SIZE - SLOTS_PER_WORD)
+#define NODES_PER_WORD          64
+#define NODE_WORDS(n)           (((n) + NODES_PER_WORD - 1) / NODES_PER_WORD)
+
+/*
+ * Backoff policies. POLICY_DOUBLE is the modification under study: the CW
+ * doubles on every collision and is never reset. POLICY_RESET is standard
+ * 802.11, going back to the initial CW after a successful transmission.
+ */
+#define POLICY_DOUBLE           0
+#define POLICY_RESET            1
+
+/*
+ * Node count size classes the engine can be specialized for. A class
+ * covers every node count up to its limit.
+ */
+#define SIZE_CLASS_WORD         0       /* Up to NODES_PER_WORD nodes */
+#define SIZE_CLASS_SMALL        1       /* Up to SIZE_CLASS_SMALL_MAX */
+#define SIZE_CLASS_ANY          2
+#define SIZE_CLASS_SMALL_MAX    1024
+
+/*
+ * Engine instances generated at compile time, as (pkt_size, size class,
+ * policy) triples. Build with -D'ENGINE_SPECIALIZATIONS(X)=...' to pick a
+ * different set. Everything else goes to the generic engine.
+ */
+#ifndef ENGINE_SPECIALIZATIONS
+#define ENGINE_SPECIALIZATIONS(X)                                           \
+    X(1,   WORD,  DOUBLE)   X(1,   SMALL, DOUBLE)                           \
+    X(10,  WORD,  DOUBLE)   X(10,  SMALL, DOUBLE)                           \
+    X(50,  WORD,  DOUBLE)   X(50,  SMALL, DOUBLE)                           \
+    X(100, WORD,  DOUBLE)   X(100, SMALL, DOUBLE)                           \
+    X(1,   WORD,  RESET)    X(1,   SMALL, RESET)                            \
+    X(10,  WORD,  RESET)    X(10,  SMALL, RESET)                            \
+    X(50,  WORD,  RESET)    X(50,  SMALL, RESET)                            \
+    X(100, WORD,  RESET)    X(100, SMALL, RESET)
+#endif
+
+#define CONVERGENCE_INTERVAL    1000
+#define CONVERGENCE_DELTA       0.0005
+
+/*
+ * Per-run memory comes from arenas of ARENA_CHUNK_SIZE chunks, with every
+ * allocation aligned to a cache line
+ */
+#define ARENA_CHUNK_SIZE        (1 << 20)
+#define ARENA_ALIGN             64
+#define ARENA_ROUND(n)          (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/*
+ * Chunks of at least a huge page are mapped directly and aligned to a huge
+ * page boundary so that transparent huge pages can back them
+ */
+#define HUGE_PAGE_SIZE          ((size_t)2 << 20)
+#define HUGE_ROUND(n)           (((n) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1))
+
+/*
+ * A scenario may mix classes of nodes, each with its own node count and
+ * initial CW. Nodes are numbered class by class.
+ */
+#define MAX_NODE_CLASSES        8
+
+/*
+ * Nodes may join and leave during a run, either at scripted slots or as a
+ * birth-death process. Nodes that come and go need room up to the node
+ * capacity, which defaults to CHURN_HEADROOM times the population that the
+ * script alone can reach when there are random arrivals.
+ */
+#define MAX_CHURN_EVENTS        64
+#define CHURN_HEADROOM          10
+
+/*
+ * Without a load schedule every node always has a packet to send. With one,
+ * packets arrive at the nodes of each class as a Poisson process whose rate
+ * follows the schedule, and wait in a FIFO queue of up to queue_limit
+ * packets. A node with an empty queue is parked: it is left out of the
+ * countdown, with a backoff that can't run out.
+ */
+#define MAX_LOAD_EVENTS         64
+#define DEFAULT_QUEUE_LIMIT     64
+#define PARKED_BACKOFF          INT32_MAX
+
+/*
+ * Frame aggregation. A node that gets the channel sends up to agg_frames
+ * of its frames in one transmission of pkt_size slots for the first frame
+ * and subframe_slots for every further one. A-MPDU subframes are acked one
+ * by one in a block ACK, A-MSDU subframes share one checksum. Within a
+ * TXOP of up to txop_slots, it may go on with further transmissions
+ * sifs_slots apart. Unless given, a subframe takes SUBFRAME_SHARE of a
+ * packet, the rest being the preamble and the ACK that a transmission only
+ * has once.
+ */
+#define AGG_NONE                0
+#define AGG_AMPDU               1
+#define AGG_AMSDU               2
+#define MAX_AGG_FRAMES          64
+#define SUBFRAME_SHARE          0.75
+
+/*
+ * Rate adaptation. Every node has a link of its own SNR and sends at one of
+ * the MAX_RATES 802.11a rates. A frame that takes pkt_size (or
+ * subframe_slots) slots at the top rate takes proportionally longer at a
+ * lower one, and is lost with a probability that falls off logistically,
+ * PER_SLOPE per dB, with the margin of the SNR over the threshold of the
+ * rate. RATE_NONE keeps the fixed frame duration and an error-free channel.
+ */
+#define RATE_NONE               0
+#define RATE_FIXED              1
+#define RATE_ARF                2
+#define RATE_AARF               3
+#define RATE_MINSTREL           4
+#define MAX_RATES               8
+#define DEFAULT_SNR             30.0
+#define PER_SLOPE               2.0
+#define ARF_UP                  10      /* Successes in a row to move up */
+#define ARF_DOWN                2       /* Failures in a row to move down */
+#define AARF_MAX_UP             50
+#define MINSTREL_EWMA           0.25    /* Weight of the latest attempt */
+#define MINSTREL_SAMPLE         0.1     /* Share of attempts at random rates */
+
+/*
+ * OFDMA uplink random access (802.11ax UORA). Every trigger frame of the AP
+ * takes trigger_slots and opens ru_count random-access RUs for the pkt_size
+ * slots of one transmission. The CW of a class is its initial OFDMA
+ * contention window, which doubles up to ocw_max.
+ */
+#define MAX_RUS                 74      /* 26-tone RUs in 160 MHz */
+#define DEFAULT_OCW_MAX         32
+#define DEFAULT_TRIGGER_SLOTS   2
+
+/*
+ * Energy accounting. A node is always in one of the ENERGY_STATES states,
+ * each with a power draw of its own, and a slot lasts slot_time us. The
+ * default draws are roughly those of a low-power 802.11 module.
+ */
+#define ENERGY_TX               0
+#define ENERGY_RX               1
+#define ENERGY_IDLE             2
+#define ENERGY_SLEEP            3
+#define ENERGY_STATES           4
+#define DEFAULT_SLOT_TIME       9.0     /* 802.11a/g/n/ac/ax, us */
+#define DEFAULT_FRAME_BITS      12000   /* 1500 byte frames */
+#define DEFAULT_TX_POWER        0.8     /* W */
+#define DEFAULT_RX_POWER        0.3
+#define DEFAULT_IDLE_POWER      0.25
+#define DEFAULT_SLEEP_POWER     0.0005
+
+/*
+ * Management traffic of the AP. It sends a beacon of beacon_slots for each
+ * of its ssid_count SSIDs every beacon_interval slots, and probe and
+ * association exchanges of probe_slots arrive at probe_rate per slot. The
+ * AP has priority access: it takes the channel at the first idle slot,
+ * ahead of any node.
+ */
+#define DEFAULT_BEACON_SLOTS    30      /* 250 bytes at 6 Mbps */
+#define DEFAULT_PROBE_SLOTS     100
+
+/*
+ * Downlink traffic. The AP carries the downlink frames of every node as
+ * one more contender, the only node of a class of its own after the
+ * others, with a queue of up to ap_queue frames. Frames reach it at
+ * ap_load per node and slot.
+ */
+#define DEFAULT_AP_QUEUE        1024
+#define FLOW_UPLINK             0
+#define FLOW_DOWNLINK           1
+#define FLOWS                   2
+
+/*
+ * Topologies. By default every node hears every other and every
+ * transmission reaches every receiver. Otherwise a node only defers to the
+ * transmissions it hears, and a frame is lost if a transmission that
+ * reaches its receiver overlaps it. Each node sends to a receiver of its
+ * own. A topology is either given link by link, or geometric: nodes are
+ * placed uniformly in a square of side area, in units of the longest
+ * range, with ranges uniform in [1 - range_spread, 1] and their receivers
+ * link_distance of their range away. Links come from the scenario file, and
+ * are kept on the arena of the batch in an array that starts with room for
+ * TOPO_EDGE_ROOM edges and doubles whenever it fills up.
+ */
+#define TOPO_SHARED             0
+#define TOPO_GEOMETRIC          1
+#define TOPO_LINKS              2
+#define TOPO_HEAR               0       /* Edge to a node that hears */
+#define TOPO_REACH              1       /* Edge to a node's receiver */
+#define TOPO_EDGE_ROOM          64
+#define MAX_TOPO_AREA           1024
+#define DEFAULT_LINK_DISTANCE   0.5
+
+/*
+ * Exact Markov chain solver. A saturated node whose counter was drawn
+ * uniformly from [1, W] and hasn't run out after d decrements has a
+ * counter uniform in [1, W - d], so at the slots in which counters move, a
+ * node is in one of the (backoff stage, counter range) states. The nodes
+ * of a single class are interchangeable, so the chain only tracks how many
+ * nodes are in each state. The CW stops doubling at max_stage. Chains of
+ * more than MAX_MARKOV_STATES states or MAX_MARKOV_TRANSITIONS transitions
+ * aren't solved. The arrays start with room for MARKOV_ROOM of each, and
+ * double as the chain grows.
+ */
+#define MAX_MARKOV_NODES        8
+#define MAX_MARKOV_STAGE        10
+#define MAX_MARKOV_COUNTERS     UINT16_MAX
+#define MAX_MARKOV_STATES       (1 << 22)
+#define MAX_MARKOV_TRANSITIONS  (1 << 25)
+#define MARKOV_ROOM             1024
+#define MARKOV_TOLERANCE        1e-13
+#define MARKOV_MAX_ITERATIONS   100000
+
+/*
+ * Mean-field solver. With many nodes, each of them sees the others send
+ * independently at the rate of their share of the population, so the
+ * fraction of the nodes of each class at each backoff stage and counter
+ * range follows deterministic dynamics. Stages whose CW is past the slot
+ * horizon are only ever entered, so they need no history. The last step
+ * is only a fixed point if the share of no class at any stage moved by
+ * more than MEANFIELD_TOLERANCE in it.
+ */
+#define MEANFIELD_MIN_SHARE     0.0005  /* Smallest stage share printed */
+#define MEANFIELD_TOLERANCE     1e-9
+
+/*
+ * Rare-event estimation. Every packet of node 0 is followed once more from
+ * the state in which it starts, with the other nodes drawing their
+ * backoffs towards its counter, and weighted by its likelihood ratio.
+ */
+#define DEFAULT_TILT            2.0
+#define RARE_MAX_AIM            0.9     /* Most a draw aims at node 0 */
+#define RARE_SEED_SALT          0x9e3779b9u     /* Seed of the clones */
+
+/*
+ * Splitting, the alternative to the tilt. A clone is split into copies of
+ * equal weight whenever its packet collides once more or waits past
+ * another SPLIT_STARVE_LEVELS-th of starve_slots. A packet stops being
+ * split once SPLIT_MAX_PATHS copies have been made from it.
+ */
+#define MAX_SPLIT               64
+#define SPLIT_STARVE_LEVELS     4
+#define SPLIT_MAX_PATHS         (1 << 16)
+
+/* Scenario files */
+#define MAX_SCENARIOS           256
+#define MAX_NAME_LEN            64
+#define MAX_LINE_LEN            256
+#define MAX_PATH_LEN            256
+#define SCENARIO_CLASSES        0x1     /* Section has its own classes */
+#define SCENARIO_CHURN          0x2     /* Section has its own churn script */
+#define SCENARIO_LOAD           0x4     /* Section has its own load schedule */
+#define SCENARIO_EDGES          0x8     /* Section has its own topology links */
+#define SCENARIO_NODES          0x10    /* Section has node_count or cw_size */
+
+#define MAX_SEGMENT_COUNT       64
+#define DEFAULT_TOLERANCE       0.10
+#define COARSE_STEP             100
+
 /* Globals */
 
-typedef struct slot_ {
-    int    state;
-} slot_t;
+typedef uint64_t slot_t;
+typedef uint64_t bitset_t;
 
 typedef struct node_ {
     int    backoff;
     int    cw_size;
-    int    prev_state;
 } node_t;
 
-slot_t slots[MAX_SLOT_SIZE];
-node_t nodes[MAX_NODE_COUNT];
-int slot_size, pkt_size, node_count, cw_size;
-int idle_slots, collision_slots, transmission_slots, packet_count;
+typedef struct node_class_ {
+    int    count;
+    int    cw_size;
+} node_class_t;
 
 /*
- * Main entry point
+ * Scripted change of the population of a node class at a given slot
  */
-int 
-main (int argc, char *argv[])
-{
-    int collision_count, colliding_nodes[100]; 
-    int status;
-    int i, j, k;
-    float cur_efficiency = 0.0, prev_efficiency = 0.000001;
-    float cur_delta = 1.0, prev_delta = 1.0;
+typedef struct churn_ {
+    int    slot;
+    int    class_index;
+    int    delta;
+} churn_t;
 
-    if (argc != 4) {
-        printf("syntax: ./Simulation <pkt-size> <node-count> <cw-size>\n");
-        exit(0);
-    }
+/*
+ * Offered load per node of a class from a given slot on, in packets per
+ * slot
+ */
+typedef struct load_ {
+    int    slot;
+    int    class_index;
+    double rate;
+} load_t;
 
-    /* Validate the inputs */
-    pkt_size = atoi(argv[1]);
-    node_count = atoi(argv[2]);
-    cw_size = atoi(argv[3]);
+typedef struct packet_ {
+    struct packet_ *next;
+    int    arrival;                 /* Slot the packet arrived in */
+} packet_t;
 
-    if ((pkt_size > MAX_PKT_SIZE) || (node_count > MAX_NODE_COUNT) || 
-        (cw_size > MAX_CW_SIZE)) {
-        printf("Error taking inputs!\n");
-        exit(1);
-    }
+typedef struct queue_ {
+    packet_t *head, *tail;
+    int    length;
+} queue_t;
 
-    /* 
-     * Slot size can be infinite. For this program, we will assume that it
-     * can't exceed one million slots.
+/*
+ * Rate adaptation state of the link of a node. The loss probability at
+ * every rate is worked out once, when the node joins.
+ */
+typedef struct link_ {
+    float  snr;
+    float  per[MAX_RATES];
+    float  prob[MAX_RATES];         /* Minstrel delivery estimates */
+    int    rate;                    /* Rate of the next transmission */
+    int    successes, failures;     /* In a row */
+    int    threshold;               /* Successes to move up */
+    int    probing;                 /* First attempt after moving up */
+    int    attempts[MAX_RATES];
+    int    delivered;
+} link_t;
+
+/*
+ * Energy record of a node. It listens to the channel from the time it
+ * joins, when the channel had been idle for idle_base slots and busy for
+ * busy_base, except while it transmits or sleeps.
+ */
+typedef struct energy_ {
+    int    idle_base, busy_base;
+    int    tx, sleep;               /* Slots */
+    int    delivered;
+} energy_t;
+
+/*
+ * Power-save state of a node. Between beacons, a node with nothing to send
+ * dozes, and keeps what reaches its queue meanwhile for the next beacon. It
+ * wakes for every beacon and stays awake for beacon_slots to hear the TIM,
+ * which lists the nodes the AP buffers downlink frames for. Those nodes,
+ * and the ones with uplink frames, contend from the beacon on: a PS-Poll
+ * exchange fetches one downlink frame, and they doze again once they have
+ * nothing left.
+ *
+ * A dozing node is parked. Since is the slot it went to sleep, or stops
+ * listening to a beacon, while it dozes, and the beacon that woke it while
+ * it is awake.
+ */
+typedef struct ps_ {
+    int    dozing;
+    int    since;
+    int    pending;                 /* Downlink frames buffered at the AP */
+} ps_t;
+
+/*
+ * Directed edge of a topology given link by link, from a transmitting node
+ * to a node that hears it or whose receiver it reaches
+ */
+typedef struct topo_edge_ {
+    int    from, to;
+    int    kind;                    /* TOPO_HEAR or TOPO_REACH */
+} topo_edge_t;
+
+/*
+ * Sensing and interference graphs of a topology, in compressed sparse row
+ * form. A transmission of node j is heard by the nodes hear[hear_start[j]]
+ * up to hear[hear_start[j + 1]], and reaches the receivers of the nodes
+ * reach[reach_start[j]] up to reach[reach_start[j + 1]].
+ */
+typedef struct topo_ {
+    int   *hear_start, *hear;
+    int   *reach_start, *reach;
+} topo_t;
+
+/*
+ * Binary min-heap of nodes keyed by key[node], which knows where each node
+ * sits so that any node can be taken out. pos is -1 for the nodes that
+ * aren't in it.
+ */
+typedef struct heap_ {
+    int        *node, *pos;
+    const int  *key;
+    int         count;
+} heap_t;
+
+/*
+ * Traffic in one direction
+ */
+typedef struct flow_ {
+    int    packets;
+    int    arrivals, drops;
+    double delay_sum;
+} flow_t;
+
+/*
+ * Drops and starvation of the packets of node 0: sums of the weighted
+ * events over the clones, and counts over the packets of the run itself
+ */
+typedef struct rare_ {
+    int    samples, packets, paths;
+    double drop_sum, drop_sq, starve_sum, starve_sq;
+    int    drops, starved;
+} rare_t;
+
+/*
+ * Clone being split. The counter of a node is kept as the step of the
+ * clone in which it runs out, so a transmission only changes its senders.
+ * The copies of a clone share its nodes: each copy saves a node to the
+ * undo log before it first changes it, and the log is rolled back before
+ * the next copy starts.
+ */
+typedef struct split_ {
+    long          *key;
+    int           *cw_size;
+    int           *saved;           /* Copy that last saved each node */
+    int           *log_node, *log_saved, *log_cw;
+    long          *log_key;
+    int            log_count;
+    int            copy, copies, paths;
+    unsigned int   seed;
+    double         drop, starve;    /* Weight of the copies with each event */
+} split_t;
+
+/*
+ * Cumulative statistics of a run at the end of a stats window or a load
+ * phase
+ */
+typedef struct window_ {
+    int    slot;
+    int    node_count;
+    double node_slots;              /* Population summed over slots */
+    int    idle_slots, collision_slots, transmission_slots;
+    int    packet_count;
+    int    arrivals, drops;
+    double delay_sum;               /* Arrival to end of transmission */
+} window_t;
+
+/*
+ * Statistics over one window or phase, worked out from the cumulative ones
+ */
+typedef struct stats_ {
+    int    start, end;
+    double nodes, efficiency, throughput, offered, delay;
+    int    drops;
+} stats_t;
+
+/*
+ * An arena hands out memory for the state of a run and gets it all back at
+ * once on reset. Chunks are kept across resets, so a worker that executes
+ * many runs stops calling malloc after the first one.
+ */
+typedef struct arena_chunk_ {
+    struct arena_chunk_ *next;
+    size_t               size;
+    size_t               used;
+    int                  mapped;    /* Comes from mmap rather than malloc */
+} arena_chunk_t;
+
+typedef struct arena_ {
+    arena_chunk_t  *first;
+    arena_chunk_t  *cur;
+} arena_t;
+
+/*
+ * Pool of fixed-size objects carved out of an arena. Released objects go to
+ * a free list and are handed out again before the arena is touched.
+ */
+typedef struct pool_ {
+    arena_t        *arena;
+    size_t          size;
+    void           *free_list;
+} pool_t;
+
+typedef struct config_ {
+    int          pkt_size;
+    int          node_count;
+    int          cw_size;
+    int          slot_size;         /* Slot horizon of the run */
+    int          fixed;             /* Run the full horizon, no convergence */
+    int          segment_count;     /* Parareal segments, 0 if sequential */
+    int          max_iterations;    /* Parareal correction iterations */
+    double       tolerance;         /* Allowed boundary state divergence */
+    int          policy;            /* POLICY_DOUBLE or POLICY_RESET */
+    int          approx;            /* Use the p-persistent approximation */
+    int          compare;           /* Compare approximate and exact runs */
+    unsigned int seed;
+    int          pin;               /* Pin worker threads to CPUs */
+    int          class_count;
+    node_class_t classes[MAX_NODE_CLASSES];
+    int          node_capacity;     /* Most nodes present at any time */
+    int          churn_count;
+    churn_t      churn[MAX_CHURN_EVENTS];   /* In slot order */
+    double       birth_rate;        /* Node arrivals per slot */
+    double       death_rate;        /* Departures per node per slot */
+    int          window;            /* Stats window in slots, 0 if none */
+    int          load_count;        /* Saturated traffic if 0 */
+    load_t       load[MAX_LOAD_EVENTS];     /* In slot order */
+    int          queue_limit;
+    int          aggregation;       /* AGG_NONE, AGG_AMPDU or AGG_AMSDU */
+    int          agg_frames;        /* Most frames per transmission */
+    int          agg_slots;         /* Longest transmission, 0 if no limit */
+    int          subframe_slots;    /* Slots per additional subframe */
+    double       subframe_error;    /* Loss probability of each subframe */
+    int          txop_slots;        /* TXOP limit, 0 for one transmission */
+    int          sifs_slots;        /* Gap between transmissions of a TXOP */
+    int          rate_control;      /* RATE_NONE, RATE_FIXED, ... */
+    int          fixed_rate;        /* Rate index for RATE_FIXED */
+    double       snr[MAX_NODE_CLASSES];     /* Mean SNR of each class, dB */
+    double       snr_spread;        /* Node SNRs are uniform within this */
+    int          ru_count;          /* Random-access RUs, 0 for DCF */
+    int          ocw_max;
+    int          trigger_slots;
+    int          energy;            /* Keep the energy records */
+    double       power[ENERGY_STATES];      /* W */
+    double       slot_time;         /* us */
+    int          frame_bits;
+    int          beacon_interval;   /* Slots, 0 for no beacons */
+    int          beacon_slots;
+    int          ssid_count;
+    double       probe_rate;        /* Probe exchanges per slot */
+    int          probe_slots;
+    int          power_save;
+    double       dl_rate;           /* Downlink frames per node and slot */
+    double       ap_load;           /* AP frames per node and slot, 0 if none */
+    int          ap_cw;             /* 0 for the CW of the first class */
+    int          ap_queue;
+    int          ap_class;          /* -1 if there is no AP */
+    int          topology;          /* TOPO_SHARED, TOPO_GEOMETRIC, ... */
+    double       area;
+    double       range_spread;
+    double       link_distance;
+    int          edge_count, edge_room;
+    topo_edge_t *edges;             /* Shared with inheriting sections */
+    int          markov;            /* Solve the Markov chain instead */
+    int          max_stage;
+    int          mean_field;        /* Or iterate the mean-field dynamics */
+    int          retry_limit;       /* Collisions that drop a packet */
+    int          starve_slots;      /* Access delay that starves a node */
+    double       tilt;              /* Odds of a backoff hitting node 0 */
+    int          split;             /* Copies per split, 0 to tilt instead */
+} config_t;
+
+/*
+ * Markov chain being built. A chain state is stored as the sorted
+ * single-node states of its nodes, and found through an open addressing
+ * hash table. Single-node state first[s] + r - 1 has backoff stage s and
+ * counter range r. The transitions of each chain state follow those of the
+ * states before it.
+ */
+typedef struct markov_ {
+    const config_t *cfg;
+    arena_t       *arena;
+    int            nodes;
+    int            first[MAX_MARKOV_STAGE + 2];
+    int           *stage_of, *range_of;
+    uint16_t      *states;
+    int            state_count, state_room;
+    int           *table;
+    unsigned int   table_mask;
+    double        *quiet, *single;          /* No node or one node sends */
+    int           *row_start, *target;
+    double        *prob;
+    int            transition_count, transition_room;
+} markov_t;
+
+/*
+ * State of a single run covering the window [slot_base,
+ * slot_base + slot_count). Slot states are kept in a ring indexed by the
+ * slot number relative to slot_base.
+ *
+ * A node has to sense a full idle slot before it may decrement its backoff.
+ * The nodes that sensed a busy slot last are tracked in the busy bitset, so
+ * that freezing and unfreezing every node takes a handful of word stores.
+ * Parked nodes are kept out of the countdown the same way.
+ */
+typedef struct sim_ sim_t;
+typedef int (*engine_fn)(sim_t *sim, int end, int converge);
+
+struct sim_ {
+    const config_t *cfg;
+    engine_fn       engine;         /* Engine instance for cfg */
+    slot_t         *slots;
+    int             slot_base;
+    int             slot_count;
+    node_t         *nodes;
+    bitset_t       *busy;
+    int             all_busy;       /* Every bit in busy is set */
+    bitset_t       *parked;         /* Nodes with nothing to send */
+    bitset_t       *expired;        /* Nodes whose backoff just expired */
+    int             slot;           /* Next slot to be simulated */
+    unsigned int    seed;
+    int             idle_slots, collision_slots, transmission_slots;
+    int             packet_count;
+    float           prev_efficiency, prev_delta;
+
+    /*
+     * Population. Nodes are numbered class by class, and class c takes
+     * node numbers up to class_end[c]. Runs with churn or stats windows
+     * are dynamic and stop the engine at every next_event.
      */
-    slot_size = MAX_SLOT_SIZE;
+    int             node_count;
+    int             class_end[MAX_NODE_CLASSES];
+    int             dynamic;
+    int             next_event;
+    int             next_churn;             /* Next scripted event */
+    int             next_birth, next_death;
+    int             blocked;                /* Arrivals beyond capacity */
+    int             next_window;
+    int             pop_slot;               /* Population unchanged since */
+    double          node_slots;
+    window_t       *windows;
+    int             window_count;
 
-    /* Initialize the data structures */
-    for (i = 0; i < slot_size; i++) {
-        slots[i].state = SLOT_STATE_IDLE;
-    }
+    /*
+     * Traffic, unless saturated. Each load change starts a new phase.
+     * Packet arrivals are taken in by the engine itself at next_packet, the
+     * first of the next_arrival slots, so they don't end its stretches.
+     */
+    queue_t        *queues;
+    pool_t          packets;
+    double          rate[MAX_NODE_CLASSES];     /* Per node and slot */
+    int             next_arrival[MAX_NODE_CLASSES];
+    int             next_packet;
+    int             next_load;
+    int             arrivals, drops;
+    double          delay_sum;
+    window_t       *phases;
+    int             phase_count;
 
-    for (i = 0; i < node_count; i++) {
-        nodes[i].backoff = INVALID_BACKOFF;
-        nodes[i].cw_size = cw_size;
-        nodes[i].prev_state = SLOT_STATE_IDLE;
-    }
+    /*
+     * Set if transmissions may be aggregated or lost or come in TXOPs, in
+     * which case successful accesses go through sim_burst
+     */
+    int             bursts;
+    int             frame_limit;            /* Frames per transmission */
+    int             lost_frames;
+    int             txops, transmissions;
+    int             gap_slots;              /* SIFS slots within TXOPs */
 
-    /* Initialize the random seed generator */
-    srand(time(NULL));
-
-    /* 
-     * Main loop. For each slot, do the following:
-     *
-     * 1. For each node, check if the slot is free. If it is, decrement
-     *    backoff. If backoff expires, transmit the packet.
-     * 2. If the slot is not free, wait till it becomes free and then
-     *    decrement backoff
-     * 3. If 2 nodes simultaneoulsly expire their backoff, then there will
-     *    be a collision for packet-size slots.
-     * 4. In case of a collision, the colliding nodes double their CW size.
+    /*
+     * Rate adaptation, with transmission lengths and frames per
+     * transmission for every rate
      */
+    link_t         *links;
+    int             rate_pkt[MAX_RATES], rate_sub[MAX_RATES];
+    int             rate_frames[MAX_RATES];
+    int             rate_attempts[MAX_NODE_CLASSES][MAX_RATES];
+    int             rate_delivered[MAX_NODE_CLASSES][MAX_RATES];
 
-    for (i = 0; i < slot_size; i++) {
+    /* UORA trigger frames, and the outcomes on each RU */
+    int             triggers;
+    int             ru_success[MAX_RUS], ru_collision[MAX_RUS];
 
-        /* Reset the collision count */
-        collision_count = 0;
+    /* Energy records, and the slots of each class's nodes that have left */
+    energy_t       *energy;
+    double          energy_left[MAX_NODE_CLASSES][ENERGY_STATES];
+    int             delivered_left[MAX_NODE_CLASSES];
 
-        /* For each node */
-        for (j = 0; j < node_count; j++) {
+    /*
+     * Management traffic of the AP, with the slots of it that wait for the
+     * channel and the slot at which they may take it next
+     */
+    int             next_beacon, beacons, next_probe;
+    int             mgmt_due, next_mgmt;
+    int             mgmt_slots;
 
-            if (slots[i].state == SLOT_STATE_IDLE &&
-                nodes[j].prev_state == SLOT_STATE_IDLE) {
-                /*
-                 * Both the current and previous slots are idle. Decrement
-                 * backoff. Initialize backoff if we are coming here for the
-                 * first time.
-                 */
-                if (nodes[j].backoff == INVALID_BACKOFF) { 
-                    nodes[j].backoff = (rand() % nodes[j].cw_size) + 1;
-                }
+    /*
+     * Power save. A burst runs from a beacon that wakes nodes until as
+     * many nodes have gone back to sleep, or the next beacon.
+     */
+    ps_t           *ps;
+    int             woken, max_woken;
+    int             polls, dl_drops;
+    double          poll_delay;
+    int             burst_left, burst_start, burst_base;
+    int             bursts_closed;
+    double          burst_slots, burst_collisions;
 
-                nodes[j].backoff -= 1;
-                if (nodes[j].backoff == 0) {
-                    /* 
-                     * Ready to transmit the packet. Make a note of all 
-                     * such nodes whose backoff expires in the same slot. 
-                     * This will help us determine if there was a 
-                     * successful transmission in this slot.
-                     */
-                    colliding_nodes[collision_count++] = j;
-                }
-            } else if (slots[i].state == SLOT_STATE_IDLE &&
-                       nodes[j].prev_state != SLOT_STATE_IDLE) {
-                /*
-                 * We need to sense an idle slot for the full slot duration.
-                 * Hence this check. Once the previous state and the current
-                 * state are both idle, we decrement backoff.
-                 */
-                nodes[j].prev_state = SLOT_STATE_IDLE;
-            } else {
-                /*
-                 * When we are decrementing our backoff, some other node's
-                 * backoff may expire and it may start transmitting. In such
-                 * a case,we should freeze our backoff counter till the other
-                 * transmission is complete. To acheive this, we set the
-                 * node's slot state accordingly.
-                 */
-                nodes[j].prev_state = slots[i].state;
-            }
-        }
+    /* Downlink traffic, which the AP node carries */
+    flow_t          downlink;
 
-        /*
-         * We have processed all the nodes. Check the collision count. There 
-         * can be 3 cases:
-         *
-         * 1. collision_count = 0: None of the nodes expired their backoff.
-         *    The slot state will either be transmission, collision or idle.
-         * 2. collision_count = 1: Only one guy expired the backoff. This
-         *    indicates successful transmission.
-         * 3. collision_count > 1: Since many guys transmit simultaneously,
-         *    there will be a collision
-         */
-        switch (collision_count) {
-            case 0:
-                /* 
-                 * No change in slot state. It will already be set to 
-                 * transmission, collision or idle. Nothing to update here.
-                 */
-                break;
+    /*
+     * Topology, with the backoffs frozen by a transmission the node hears
+     * and those of them in which it could have sent without harm
+     */
+    int             hear_links, one_way, reach_links;
+    int             deferrals, exposed;
+    double          fairness;
 
-            case 1:
-                /* Successful transmission */
-                for (k = i; k < (i + pkt_size); k++) {
-                    slots[k].state = SLOT_STATE_TRANSMISSION;
-                }
+    /*
+     * Markov chain or mean-field solution, with the share of the nodes of
+     * each class at each stage when the mean field ends, and how much it
+     * moved in the last step
+     */
+    int             markov_states, markov_transitions, markov_iterations;
+    double          model_efficiency, model_throughput;
+    int             meanfield_steps, meanfield_stages;
+    double          meanfield_final, meanfield_drift;
+    double          stage_share[MAX_NODE_CLASSES][MAX_BACKOFF_STAGE];
 
-                /* Reset the backoff counter */
-                nodes[colliding_nodes[0]].backoff = INVALID_BACKOFF;
+    /* Rare events of the packets of node 0 */
+    rare_t          rare;
+};
 
-                /* Update the packet count */
-                packet_count++;
+typedef struct engine_ {
+    int            pkt_size;
+    int            size_class;
+    int            policy;
+    engine_fn      run;
+} engine_t;
 
-                break;
+/*
+ * Node and channel state at a slot boundary, used to start a run in the
+ * middle of the horizon. spill gives the state of the first pkt_size slots,
+ * which may still be busy with a transmission started earlier. The node
+ * arrays follow the header in the same pool object.
+ */
+typedef struct snapshot_ {
+    node_t        *nodes;
+    bitset_t      *busy;
+    unsigned char  spill[MAX_PKT_SIZE];
+} snapshot_t;
 
-            default:
-                /*
-                 * Collision. First set the slot state for the affected slots.
-                 * For each colliding node, double the CW size and reset the 
-                 * backoff counter.
-                 */
-                for (k = i; k < (i + pkt_size); k++) {
-                    slots[k].state = SLOT_STATE_COLLISION;
-                }
+/*
+ * One time segment of a parareal run. Each segment is simulated from its own
+ * starting state, which is either predicted or copied from the end of the
+ * segment to its left. The run state of a segment lives in the arena of the
+ * thread that simulates it.
+ */
+typedef struct segment_ {
+    const config_t *cfg;
+    int            index;
+    int            first;                   /* First slot of the segment */
+    int            last;                    /* One past the last slot */
+    snapshot_t    *start;                   /* Starting state */
+    int            dirty;                   /* Needs to be (re)simulated */
+    unsigned int   seed;
+    arena_t        arena;
+    sim_t          sim;
+    pthread_t      thread;
+} segment_t;
 
-                for (k = 0; k < collision_count; k++) {
-                    nodes[colliding_nodes[k]].backoff = INVALID_BACKOFF;
-                    nodes[colliding_nodes[k]].cw_size *= 2;
-                }
+/*
+ * Totals of one replication of a batch scenario
+ */
+typedef struct result_ {
+    int            slots;
+    int            converged;
+    int            idle_slots, collision_slots, transmission_slots;
+    int            packet_count;
+    int            lost_frames;
+    int            rate_attempts[MAX_NODE_CLASSES][MAX_RATES];
+    int            rate_delivered[MAX_NODE_CLASSES][MAX_RATES];
+    int            triggers;
+    int            ru_success[MAX_RUS], ru_collision[MAX_RUS];
+    double         energy[MAX_NODE_CLASSES][ENERGY_STATES];
+    int            delivered[MAX_NODE_CLASSES];
+    flow_t         flows[FLOWS];
+    int            hear_links, one_way, reach_links;
+    int            deferrals, exposed;
+    double         fairness;
+    double         model_efficiency, model_throughput;
+    rare_t         rare;
+    window_t      *windows;
+    int            window_count;
+    window_t      *phases;
+    int            phase_count;
+} result_t;
 
-                break;
+/*
+ * A scenario of a batch, read from a scenario file. Its replications are
+ * independent runs that differ only in their seed. Jobs first_job to
+ * first_job + replications - 1 of the batch belong to the scenario.
+ */
+typedef struct scenario_ {
+    char           name[MAX_NAME_LEN];
+    config_t       cfg;
+    int            replications;
+    char           output[MAX_PATH_LEN];   /* Per-replication CSV, or "" */
+    char           window_output[MAX_PATH_LEN];    /* Per-window CSV */
+    char           phase_output[MAX_PATH_LEN];     /* Per-phase CSV */
+    char           rate_output[MAX_PATH_LEN];      /* Per-rate CSV */
+    char           ru_output[MAX_PATH_LEN];        /* Per-RU CSV */
+    char           energy_output[MAX_PATH_LEN];    /* Per-class CSV */
+    char           flow_output[MAX_PATH_LEN];      /* Per-direction CSV */
+    char           topology_output[MAX_PATH_LEN];  /* Per-replication CSV */
+    char           rare_output[MAX_PATH_LEN];      /* Per-replication CSV */
+    int            first_job;
+} scenario_t;
+
+/*
+ * Batch of scenarios executed by a pool of worker threads. Workers take the
+ * next job from a shared counter until every replication has been run.
+ */
+typedef struct batch_ {
+    scenario_t    *scenarios;
+    int            scenario_count;
+    int            job_count;
+    int            next_job;
+    result_t      *results;                 /* One per job */
+} batch_t;
+
+typedef struct worker_ {
+    batch_t       *batch;
+    int            index;
+    arena_t        arena;
+    pthread_t      thread;
+} worker_t;
+
+config_t config;
+cpu_set_t cpus;
+
+static const double rate_mbps[MAX_RATES] = {
+    6.0, 9.0, 12.0, 18.0, 24.0, 36.0, 48.0, 54.0
+};
+static const double rate_snr[MAX_RATES] = {         /* dB, at 50% loss */
+    4.0, 6.0, 8.0, 11.0, 14.0, 18.0, 22.0, 24.0
+};
+
+/*
+ * Get a new arena chunk with room for size bytes. Big chunks are mapped on
+ * huge page boundaries and advised to use transparent huge pages where the
+ * kernel supports them. Pages aren't touched here, so they end up on the
+ * NUMA node of the thread that first writes them, which is the worker
+ * that is going to scan them.
+ */
+static arena_chunk_t *
+arena_chunk_new (size_t size)
+{
+    size_t header = ARENA_ROUND(sizeof(arena_chunk_t)), len;
+    arena_chunk_t *chunk;
+    char *map, *aligned;
+
+    if (header + size < HUGE_PAGE_SIZE) {
+        chunk = aligned_alloc(ARENA_ALIGN, header + size);
+        if (chunk == NULL) {
+            printf("Out of memory!\n");
+            exit(1);
+        }
+        chunk->mapped = 0;
+    } else {
+        len = HUGE_ROUND(header + size);
+        map = mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            printf("Out of memory!\n");
+            exit(1);
         }
 
-        /* Collect Statistics */
-        if (slots[i].state == SLOT_STATE_IDLE) {
-            idle_slots++;
-        } else if (slots[i].state == SLOT_STATE_TRANSMISSION) {
-            transmission_slots++;
-        } else {
-            collision_slots++;
+        /* Trim the mapping down to a huge page aligned range */
+        aligned = (char *)HUGE_ROUND((uintptr_t)map);
+        if (aligned > map) {
+            munmap(map, aligned - map);
         }
+        munmap(aligned + len, map + HUGE_PAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+        chunk = (arena_chunk_t *)aligned;
+        chunk->mapped = 1;
+        size = len - header;
+    }
 
-        /*
-         * We use the following criteria to determine when to stop the
-         * simulation. At each slot boundary, we calculate the efficiency
-         * and store the delta i.e efficiency calculated at this slot minus
-         * the efficiency calculated at the previous slot. We compare this
-         * delta with the delta obtained in the previous iteration. If both
-         * the deltas are less than 0.05%, then we conclude that the 
-         * simulation has converged.
-         */
-        if (((i % 1000) == 0) && (i != 0)) {
-            cur_efficiency = (float)transmission_slots / (float)i;
-            cur_delta = (cur_efficiency > prev_efficiency) ?
-                        (cur_efficiency - prev_efficiency) :
-                        (prev_efficiency - cur_efficiency);
+    chunk->next = NULL;
+    chunk->size = size;
 
-            if (cur_delta < 0.0005 && prev_delta < 0.0005) {
-                break;
+    return chunk;
+}
+
+/*
+ * Allocate size bytes from the arena. Memory is not cleared.
+ */
+static void *
+arena_alloc (arena_t *arena, size_t size)
+{
+    arena_chunk_t *chunk = arena->cur, *next;
+    size_t chunk_size;
+    void *ptr;
+
+    size = ARENA_ROUND(size);
+    while (chunk == NULL || chunk->used + size > chunk->size) {
+        /* Move on to the next chunk, adding one if we ran out */
+        next = (chunk != NULL) ? chunk->next : arena->first;
+        if (next == NULL) {
+            chunk_size = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+            next = arena_chunk_new(chunk_size);
+            if (chunk != NULL) {
+                chunk->next = next;
+            } else {
+                arena->first = next;
             }
+        }
+        next->used = 0;
+        chunk = next;
+    }
+
+    ptr = (char *)chunk + ARENA_ROUND(sizeof(arena_chunk_t)) + chunk->used;
+    chunk->used += size;
+    arena->cur = chunk;
+
+    return ptr;
+}
+
+/*
+ * Give back everything allocated from the arena, keeping the chunks
+ */
+static void
+arena_reset (arena_t *arena)
+{
+    arena->cur = NULL;
+}
+
+static void
+arena_free (arena_t *arena)
+{
+    arena_chunk_t *chunk, *next;
 
-            prev_efficiency = cur_efficiency;
-            prev_delta = cur_delta;
+    for (chunk = arena->first; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        if (chunk->mapped) {
+            munmap(chunk, ARENA_ROUND(sizeof(arena_chunk_t)) + chunk->size);
+        } else {
+            free(chunk);
         }
     }
+    arena->first = NULL;
+    arena->cur = NULL;
+}
 
-    if (i >= slot_size) {
-        /*
-         * For some reason, our simulation didn't converge. Complain and
-         * bail.
-         */
-        printf("Simulation failed to converge. Exiting...\n");
-        exit(1);
+static void
+pool_init (pool_t *pool, arena_t *arena, size_t size)
+{
+    pool->arena = arena;
+    pool->size = (size < sizeof(void *)) ? sizeof(void *) : size;
+    pool->free_list = NULL;
+}
+
+static void *
+pool_get (pool_t *pool)
+{
+    void *obj = pool->free_list;
+
+    if (obj != NULL) {
+        pool->free_list = *(void **)obj;
+        return obj;
     }
 
-    printf("Idle Slots: %d\n", idle_slots);
-    printf("Transmission Slots: %d\n", transmission_slots);
-    printf("Collision Slots: %d\n", collision_slots);
-    printf("Packets successfully transmitted: %d\n", packet_count);
-    printf("Total slots used for simulation: %d\n", i);
-    
-    printf("Throughput: %f\n", (float)packet_count / (float)i);
-    printf(" %d %f\n", cw_size, (float)transmission_slots / (float)i);
+    return arena_alloc(pool->arena, pool->size);
+}
+
+static void
+pool_put (pool_t *pool, void *obj)
+{
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+}
+
+/*
+ * Set up a pool of snapshots for the configured node count
+ */
+static void
+snapshot_pool_init (pool_t *pool, arena_t *arena, const config_t *cfg)
+{
+    pool_init(pool, arena, ARENA_ROUND(sizeof(snapshot_t)) +
+                           ARENA_ROUND(cfg->node_count * sizeof(node_t)) +
+                           NODE_WORDS(cfg->node_count) * sizeof(bitset_t));
+}
+
+static snapshot_t *
+snapshot_get (pool_t *pool, const config_t *cfg)
+{
+    snapshot_t *snap = pool_get(pool);
+
+    snap->nodes = (node_t *)((char *)snap + ARENA_ROUND(sizeof(snapshot_t)));
+    snap->busy = (bitset_t *)((char *)snap->nodes +
+                              ARENA_ROUND(cfg->node_count * sizeof(node_t)));
+    memset(snap->busy, 0, NODE_WORDS(cfg->node_count) * sizeof(bitset_t));
+    memset(snap->spill, SLOT_STATE_IDLE, sizeof(snap->spill));
+
+    return snap;
+}
+
+static inline int
+slot_get (const slot_t *slots, int i)
+{
+    i &= SLOT_RING_SIZE - 1;
+    return (slots[i / SLOTS_PER_WORD] >>
+            ((i % SLOTS_PER_WORD) * SLOT_STATE_BITS)) & SLOT_STATE_MASK;
+}
+
+static inline void
+slot_set (slot_t *slots, int i, int state)
+{
+    int shift = (i % SLOTS_PER_WORD) * SLOT_STATE_BITS;
+
+    i &= SLOT_RING_SIZE - 1;
+    slots[i / SLOTS_PER_WORD] =
+        (slots[i / SLOTS_PER_WORD] & ~((slot_t)SLOT_STATE_MASK << shift)) |
+        ((slot_t)state << shift);
+}
+
+/*
+ * State of slot i of a run, i being an absolute slot number
+ */
+static inline int
+sim_slot (const sim_t *sim, int i)
+{
+    return slot_get(sim->slots, i - sim->slot_base);
+}
+
+/*
+ * Mark count slots starting at slot i as busy with the given state
+ */
+static inline void
+sim_mark (sim_t *sim, int i, int count, int state)
+{
+    int k;
+
+    for (k = i - sim->slot_base; k < i - sim->slot_base + count; k++) {
+        slot_set(sim->slots, k, state);
+    }
+}
+
+/*
+ * Move the ring from slot from to slot to. Every ring word whose start was
+ * passed only holds slots that are done with, so the word before it is
+ * recycled as idle slots at the far end of the ring.
+ */
+static inline void
+sim_skip (sim_t *sim, int from, int to)
+{
+    int word;
+
+    for (word = (from - sim->slot_base) / SLOTS_PER_WORD + 1;
+         word * SLOTS_PER_WORD <= to - sim->slot_base; word++) {
+        sim->slots[(word + SLOT_RING_WORDS - 1) % SLOT_RING_WORDS] = 0;
+    }
+}
+
+static int
+size_class_of (int node_count)
+{
+    if (node_count <= NODES_PER_WORD) {
+        return SIZE_CLASS_WORD;
+    } else if (node_count <= SIZE_CLASS_SMALL_MAX) {
+        return SIZE_CLASS_SMALL;
+    }
+
+    return SIZE_CLASS_ANY;
+}
+
+/*
+ * Class of node j
+ */
+static inline int
+sim_class_of (const sim_t *sim, int j)
+{
+    int c = 0;
+
+    while (j >= sim->class_end[c]) {
+        c++;
+    }
+
+    return c;
+}
+
+/*
+ * Number of nodes other than the AP. The AP, if any, is the last node.
+ */
+static inline int
+sim_stations (const sim_t *sim)
+{
+    return sim->node_count - (sim->cfg->ap_class >= 0);
+}
+
+static inline int
+sim_is_ap (const sim_t *sim, int j)
+{
+    return sim->cfg->ap_class >= 0 && j == sim->node_count - 1;
+}
+
+/*
+ * Slots node j has spent so far in each energy state. Whatever busy time
+ * is not its own transmissions it spends receiving, and it spends the
+ * idle time listening. Sleep is taken out of both in proportion.
+ */
+static void
+sim_energy (const sim_t *sim, int j, double *slots)
+{
+    const energy_t *e = &sim->energy[j];
+    double idle = sim->idle_slots - e->idle_base;
+    double rx = sim->transmission_slots + sim->collision_slots +
+                sim->mgmt_slots + sim->gap_slots - e->busy_base - e->tx;
+    double sleep = e->sleep, awake;
+
+    if (sim->ps != NULL && sim->ps[j].dozing && sim->slot > sim->ps[j].since) {
+        sleep += sim->slot - sim->ps[j].since;
+    }
+    if (sleep > 0) {
+        awake = 1.0 - sleep / (rx + idle);
+        rx *= awake;
+        idle *= awake;
+    }
+
+    slots[ENERGY_TX] = e->tx;
+    slots[ENERGY_RX] = rx;
+    slots[ENERGY_IDLE] = idle;
+    slots[ENERGY_SLEEP] = sleep;
+}
+
+/*
+ * Slots spent in each energy state by the nodes of class c so far, those
+ * that have left included. Returns the frames they delivered.
+ */
+static int
+sim_energy_class (const sim_t *sim, int c, double *slots)
+{
+    double node[ENERGY_STATES];
+    int j, k, delivered = sim->delivered_left[c];
+
+    memcpy(slots, sim->energy_left[c], ENERGY_STATES * sizeof(double));
+    for (j = (c > 0) ? sim->class_end[c - 1] : 0; j < sim->class_end[c];
+         j++) {
+        sim_energy(sim, j, node);
+        for (k = 0; k < ENERGY_STATES; k++) {
+            slots[k] += node[k];
+        }
+        delivered += sim->energy[j].delivered;
+    }
+
+    return delivered;
+}
+
+/*
+ * Joules drawn over the given slots in each energy state
+ */
+static double
+energy_joules (const config_t *cfg, const double *slots)
+{
+    double joules = 0.0;
+    int k;
+
+    for (k = 0; k < ENERGY_STATES; k++) {
+        joules += slots[k] * cfg->power[k];
+    }
+
+    return joules * cfg->slot_time * 1e-6;
+}
+
+/*
+ * Slots taken at rate r by what takes the given number of slots at the top
+ * rate
+ */
+static int
+rate_slots (int slots, int r)
+{
+    return (int)ceil(slots * rate_mbps[MAX_RATES - 1] / rate_mbps[r]);
+}
+
+/*
+ * Most frames a node may send in one transmission at rate r. Frames take
+ * longer at lower rates, so fewer of them fit in agg_slots. The top rate,
+ * MAX_RATES - 1, is the one used without rate adaptation.
+ */
+static int
+config_frame_limit (const config_t *cfg, int r)
+{
+    int limit, pkt, sub;
+
+    if (cfg->aggregation == AGG_NONE) {
+        return 1;
+    }
+
+    limit = cfg->agg_frames;
+    pkt = rate_slots(cfg->pkt_size, r);
+    sub = rate_slots(cfg->subframe_slots, r);
+    if (cfg->agg_slots > 0 && pkt + (limit - 1) * sub > cfg->agg_slots) {
+        limit = 1 + (cfg->agg_slots - pkt) / sub;
+    }
+
+    return (limit < 1) ? 1 : limit;
+}
+
+static engine_fn engine_select(const config_t *cfg);
+static void sim_arrivals(sim_t *sim, int i);
+
+/*
+ * Allocate the state for a run covering slot_count slots from slot_base.
+ * The memory belongs to the arena and is released when the arena is reset.
+ * Nothing here depends on the length of the window.
+ */
+static void
+sim_alloc (sim_t *sim, arena_t *arena, const config_t *cfg, int slot_base,
+           int slot_count)
+{
+    int r;
+
+    memset(sim, 0, sizeof(*sim));
+    sim->cfg = cfg;
+    sim->engine = engine_select(cfg);
+    sim->slot_base = slot_base;
+    sim->slot_count = slot_count;
+    sim->slots = arena_alloc(arena, SLOT_RING_WORDS * sizeof(slot_t));
+    sim->nodes = arena_alloc(arena, cfg->node_capacity * sizeof(node_t));
+    sim->busy = arena_alloc(arena, NODE_WORDS(cfg->node_capacity) *
+                                   sizeof(bitset_t));
+    sim->expired = arena_alloc(arena, NODE_WORDS(cfg->node_capacity) *
+                                      sizeof(bitset_t));
+    sim->parked = arena_alloc(arena, NODE_WORDS(cfg->node_capacity) *
+                                     sizeof(bitset_t));
+    sim->dynamic = (cfg->churn_count > 0 || cfg->birth_rate > 0.0 ||
+                    cfg->death_rate > 0.0 || cfg->window > 0 ||
+                    cfg->load_count > 0 || cfg->beacon_interval > 0 ||
+                    cfg->probe_rate > 0.0);
+    if (cfg->window > 0) {
+        sim->windows = arena_alloc(arena, (slot_count / cfg->window + 1) *
+                                          sizeof(window_t));
+    }
+    if (cfg->load_count > 0) {
+        sim->queues = arena_alloc(arena, cfg->node_capacity * sizeof(queue_t));
+        memset(sim->queues, 0, cfg->node_capacity * sizeof(queue_t));
+        pool_init(&sim->packets, arena, sizeof(packet_t));
+    }
+    if (cfg->load_count > 0) {
+        sim->phases = arena_alloc(arena, (cfg->load_count + 1) *
+                                         sizeof(window_t));
+    }
+    if (cfg->power_save) {
+        sim->ps = arena_alloc(arena, cfg->node_capacity * sizeof(ps_t));
+    }
+    sim->frame_limit = config_frame_limit(cfg, MAX_RATES - 1);
+    sim->bursts = (sim->frame_limit > 1 || cfg->subframe_error > 0.0 ||
+                   cfg->txop_slots > 0 || cfg->rate_control != RATE_NONE);
+    if (cfg->rate_control != RATE_NONE) {
+        sim->links = arena_alloc(arena, cfg->node_capacity * sizeof(link_t));
+        for (r = 0; r < MAX_RATES; r++) {
+            sim->rate_pkt[r] = rate_slots(cfg->pkt_size, r);
+            sim->rate_sub[r] = rate_slots(cfg->subframe_slots, r);
+            sim->rate_frames[r] = config_frame_limit(cfg, r);
+        }
+    }
+    if (cfg->energy) {
+        sim->energy = arena_alloc(arena,
+                                  cfg->node_capacity * sizeof(energy_t));
+    }
+}
+
+/*
+ * Draw a fresh backoff counter for node j, which takes it back into the
+ * countdown if it was parked
+ */
+static inline void
+sim_backoff (sim_t *sim, int j)
+{
+    sim->nodes[j].backoff = (rand_r(&sim->seed) % sim->nodes[j].cw_size) + 1;
+    sim->parked[j / NODES_PER_WORD] &= ~((bitset_t)1 << (j % NODES_PER_WORD));
+}
+
+/*
+ * Park node j, which has nothing to send
+ */
+static inline void
+sim_park (sim_t *sim, int j)
+{
+    sim->nodes[j].backoff = PARKED_BACKOFF;
+    sim->parked[j / NODES_PER_WORD] |= (bitset_t)1 << (j % NODES_PER_WORD);
+}
+
+/*
+ * Drop every packet queued at node j
+ */
+static void
+sim_flush (sim_t *sim, int j)
+{
+    queue_t *q = &sim->queues[j];
+    packet_t *pkt;
+
+    while ((pkt = q->head) != NULL) {
+        q->head = pkt->next;
+        pool_put(&sim->packets, pkt);
+    }
+    q->tail = NULL;
+    sim->drops += q->length;
+    q->length = 0;
+}
+
+/*
+ * Queue a packet that arrived at node j in slot i. A node that had nothing
+ * to send starts a fresh backoff.
+ */
+static void
+sim_enqueue (sim_t *sim, int j, int i)
+{
+    queue_t *q = &sim->queues[j];
+    packet_t *pkt;
+    int ap = sim_is_ap(sim, j);
+
+    sim->arrivals++;
+    sim->downlink.arrivals += ap;
+    if (q->length == (ap ? sim->cfg->ap_queue : sim->cfg->queue_limit)) {
+        sim->drops++;
+        sim->downlink.drops += ap;
+        return;
+    }
+
+    pkt = pool_get(&sim->packets);
+    pkt->next = NULL;
+    pkt->arrival = i;
+    if (q->tail != NULL) {
+        q->tail->next = pkt;
+    } else {
+        q->head = pkt;
+    }
+    q->tail = pkt;
+
+    if (q->length++ == 0 &&
+        (sim->ps == NULL || (!sim->ps[j].dozing && sim->ps[j].pending == 0))) {
+        sim_backoff(sim, j);
+    }
+}
+
+/*
+ * Node j goes to sleep at slot i
+ */
+static void
+sim_doze (sim_t *sim, int j, int i)
+{
+    sim_park(sim, j);
+    sim->ps[j].dozing = 1;
+    sim->ps[j].since = i;
+
+    if (sim->burst_left > 0 && --sim->burst_left == 0) {
+        sim->burst_slots += i - sim->burst_start;
+        sim->burst_collisions += sim->collision_slots - sim->burst_base;
+        sim->bursts_closed++;
+    }
+}
+
+/*
+ * Node j is done with a transmission at slot done. It backs off again if
+ * it has more to send, and otherwise parks, or dozes in power save.
+ */
+static void
+sim_next (sim_t *sim, int j, int done)
+{
+    if (sim->queues[j].length > 0 ||
+        (sim->ps != NULL && sim->ps[j].pending > 0)) {
+        sim_backoff(sim, j);
+    } else if (sim->ps != NULL) {
+        sim_doze(sim, j, done);
+    } else {
+        sim_park(sim, j);
+    }
+}
+
+/*
+ * Node j got a PS-Poll through, and with it one of its downlink frames,
+ * by slot done
+ */
+static void
+sim_poll (sim_t *sim, int j, int done)
+{
+    sim->ps[j].pending--;
+    sim->polls++;
+    sim->poll_delay += done - sim->ps[j].since;
+    sim_next(sim, j, done);
+}
+
+/*
+ * Node j got the packet at the head of its queue through by slot done.
+ * It backs off again for the next one, or parks if there is none.
+ */
+static void
+sim_deliver (sim_t *sim, int j, int done)
+{
+    queue_t *q = &sim->queues[j];
+    packet_t *pkt = q->head;
+
+    q->head = pkt->next;
+    if (q->head == NULL) {
+        q->tail = NULL;
+    }
+    q->length--;
+    sim->delay_sum += done - pkt->arrival;
+    if (sim_is_ap(sim, j)) {
+        sim->downlink.packets++;
+        sim->downlink.delay_sum += done - pkt->arrival;
+    }
+    pool_put(&sim->packets, pkt);
+    sim_next(sim, j, done);
+}
+
+/*
+ * Uniform random number in (0, 1)
+ */
+static double
+uniform (unsigned int *seed)
+{
+    return (rand_r(seed) + 0.5) / ((double)RAND_MAX + 1.0);
+}
+
+/*
+ * Slot of the next event of a Poisson process with the given rate per slot,
+ * counting from slot i
+ */
+static int
+sim_next_poisson (sim_t *sim, int i, double rate)
+{
+    double gap;
+
+    if (rate <= 0.0) {
+        return INT32_MAX;
+    }
+
+    gap = ceil(-log(uniform(&sim->seed)) / rate);
+    return (gap < INT32_MAX - i) ? i + (int)gap : INT32_MAX;
+}
+
+/*
+ * Sample from Poisson(mean), by inversion for small means and with a
+ * normal approximation for large ones
+ */
+static int
+poisson (unsigned int *seed, double mean)
+{
+    double pmf, cdf, u;
+    int k;
+
+    if (mean <= 0.0) {
+        return 0;
+    }
+    if (mean > 50.0) {
+        u = sqrt(-2.0 * log(uniform(seed))) * cos(2.0 * M_PI * uniform(seed));
+        k = (int)floor(mean + u * sqrt(mean) + 0.5);
+        return (k < 0) ? 0 : k;
+    }
+
+    pmf = cdf = exp(-mean);
+    u = uniform(seed);
+    for (k = 0; u > cdf; k++) {
+        pmf *= mean / (k + 1);
+        cdf += pmf;
+    }
+
+    return k;
+}
+
+/*
+ * Node j wakes at beacon b, and starts contending for the channel
+ */
+static void
+sim_wake (sim_t *sim, int j, int b)
+{
+    ps_t *ps = &sim->ps[j];
+
+    if (sim->energy != NULL && b > ps->since) {
+        sim->energy[j].sleep += b - ps->since;
+    }
+    ps->dozing = 0;
+    ps->since = b;
+    sim_backoff(sim, j);
+}
+
+/*
+ * The AP sends a beacon at slot b. The downlink frames that reached it for
+ * each node since the last one are buffered, up to queue_limit per node,
+ * and every dozing node with anything to send or fetch wakes, all in the
+ * same slot. The others sleep on once they have heard the beacon. This is
+ * one pass over the nodes per beacon, which is cheap next to the slots in
+ * between.
+ */
+static void
+sim_beacon (sim_t *sim, int b)
+{
+    const config_t *cfg = sim->cfg;
+    double mean = cfg->dl_rate * cfg->beacon_interval;
+    int j, woken = 0;
+    ps_t *ps;
+
+    if (sim->burst_left > 0) {
+        sim->burst_slots += b - sim->burst_start;
+        sim->burst_collisions += sim->collision_slots - sim->burst_base;
+        sim->bursts_closed++;
+    }
+
+    for (j = 0; j < sim->node_count; j++) {
+        ps = &sim->ps[j];
+        ps->pending += poisson(&sim->seed, mean);
+        if (ps->pending > cfg->queue_limit) {
+            sim->dl_drops += ps->pending - cfg->queue_limit;
+            ps->pending = cfg->queue_limit;
+        }
+        if (!ps->dozing) {
+            continue;
+        }
+
+        if (ps->pending > 0 || sim->queues[j].length > 0) {
+            sim_wake(sim, j, b);
+            woken++;
+        } else {
+            if (sim->energy != NULL && b > ps->since) {
+                sim->energy[j].sleep += b - ps->since;
+            }
+            ps->since = b + cfg->beacon_slots;
+        }
+    }
+
+    sim->woken += woken;
+    if (woken > sim->max_woken) {
+        sim->max_woken = woken;
+    }
+    sim->burst_left = woken;
+    sim->burst_start = b;
+    sim->burst_base = sim->collision_slots;
+}
+
+/*
+ * Number of frames node j sends when it gets the channel, and the number of
+ * slots it takes to send them
+ */
+static inline int
+sim_frames (const sim_t *sim, int j)
+{
+    int limit = (sim->links != NULL) ? sim->rate_frames[sim->links[j].rate] :
+                                       sim->frame_limit;
+
+    if (sim->queues != NULL && sim->queues[j].length < limit) {
+        return sim->queues[j].length;
+    }
+
+    return limit;
+}
+
+static inline int
+sim_tx_len (const sim_t *sim, int j, int frames)
+{
+    int r;
+
+    if (sim->links != NULL) {
+        r = sim->links[j].rate;
+        return sim->rate_pkt[r] + (frames - 1) * sim->rate_sub[r];
+    }
+
+    return sim->cfg->pkt_size + (frames - 1) * sim->cfg->subframe_slots;
+}
+
+/*
+ * Set up the link of node j, a new node of class c
+ */
+static void
+sim_link (sim_t *sim, int j, int c)
+{
+    const config_t *cfg = sim->cfg;
+    link_t *link = &sim->links[j];
+    int r;
+
+    memset(link, 0, sizeof(*link));
+    link->snr = cfg->snr[c];
+    if (cfg->snr_spread > 0.0) {
+        link->snr += cfg->snr_spread * (2.0 * uniform(&sim->seed) - 1.0);
+    }
+    for (r = 0; r < MAX_RATES; r++) {
+        link->per[r] = 1.0 / (1.0 + exp(PER_SLOPE * (link->snr - rate_snr[r])));
+        link->prob[r] = 1.0;
+    }
+
+    link->threshold = ARF_UP;
+    if (cfg->rate_control == RATE_FIXED) {
+        link->rate = cfg->fixed_rate;
+    } else if (cfg->rate_control == RATE_MINSTREL) {
+        link->rate = MAX_RATES - 1;
+    }
+}
+
+/*
+ * Tell the rate control of node j that frames - sent of the frames it just
+ * sent were lost, sent being 0 after a collision as well. Neither ARF nor
+ * Minstrel can tell a collision from a bad channel.
+ *
+ * ARF moves up a rate after ARF_UP successes in a row and down after
+ * ARF_DOWN failures in a row, or at once if the first attempt at the higher
+ * rate fails. AARF doubles the number of successes needed to move up
+ * whenever such a probe fails, and starts over when it moves down. The
+ * Minstrel-like control keeps a moving average of the delivery ratio at
+ * every rate, and sends at the rate with the best expected throughput
+ * except for a share of attempts at random rates.
+ */
+static void
+sim_feedback (sim_t *sim, int j, int frames, int sent)
+{
+    const config_t *cfg = sim->cfg;
+    link_t *link = &sim->links[j];
+    int c = sim_class_of(sim, j), r = link->rate, k, best;
+
+    link->attempts[r]++;
+    link->delivered += sent;
+    sim->rate_attempts[c][r]++;
+    sim->rate_delivered[c][r] += sent;
+
+    switch (cfg->rate_control) {
+        case RATE_ARF:
+        case RATE_AARF:
+            if (sent > 0) {
+                link->failures = 0;
+                link->probing = 0;
+                if (++link->successes >= link->threshold &&
+                    r < MAX_RATES - 1) {
+                    link->rate++;
+                    link->successes = 0;
+                    link->probing = 1;
+                }
+            } else if (link->probing) {
+                link->rate--;
+                link->probing = 0;
+                link->successes = 0;
+                if (cfg->rate_control == RATE_AARF) {
+                    link->threshold = (link->threshold * 2 > AARF_MAX_UP) ?
+                                      AARF_MAX_UP : link->threshold * 2;
+                }
+            } else {
+                link->successes = 0;
+                if (++link->failures >= ARF_DOWN) {
+                    link->failures = 0;
+                    if (r > 0) {
+                        link->rate--;
+                    }
+                    link->threshold = ARF_UP;
+                }
+            }
+            break;
+
+        case RATE_MINSTREL:
+            link->prob[r] = (1.0 - MINSTREL_EWMA) * link->prob[r] +
+                            MINSTREL_EWMA * sent / frames;
+            best = 0;
+            for (k = 1; k < MAX_RATES; k++) {
+                if (link->prob[k] * rate_mbps[k] >
+                    link->prob[best] * rate_mbps[best]) {
+                    best = k;
+                }
+            }
+            if (uniform(&sim->seed) < MINSTREL_SAMPLE) {
+                best = rand_r(&sim->seed) % MAX_RATES;
+            }
+            link->rate = best;
+            break;
+    }
+}
+
+/*
+ * Node j sends frames of its frames in a transmission of len slots that
+ * starts in slot i. Every A-MPDU subframe gets through or not on its own,
+ * and the lost ones stay queued for the next attempt. A-MSDU subframes get
+ * through or are lost together. Frames are lost to the channel at the rate
+ * of the link, and to subframe_error.
+ *
+ * Returns the number of frames that got through.
+ */
+static int
+sim_send (sim_t *sim, int j, int i, int frames, int len)
+{
+    const config_t *cfg = sim->cfg;
+    queue_t *q = NULL;
+    packet_t **link = NULL, *pkt, *kept = NULL;
+    double error = cfg->subframe_error;
+    int sent = 0, all = 1, ok, k;
+
+    if (sim->links != NULL) {
+        error = 1.0 - (1.0 - error) *
+                      (1.0 - sim->links[j].per[sim->links[j].rate]);
+    }
+    if (cfg->aggregation == AGG_AMSDU && error > 0.0) {
+        all = (uniform(&sim->seed) < pow(1.0 - error, frames));
+    }
+    if (sim->queues != NULL) {
+        q = &sim->queues[j];
+        link = &q->head;
+    }
+
+    for (k = 0; k < frames; k++) {
+        if (cfg->aggregation == AGG_AMSDU || error <= 0.0) {
+            ok = all;
+        } else {
+            ok = (uniform(&sim->seed) >= error);
+        }
+        sent += ok;
+
+        if (q == NULL) {
+            continue;
+        }
+        pkt = *link;
+        if (ok) {
+            *link = pkt->next;
+            sim->delay_sum += i + len - pkt->arrival;
+            if (sim_is_ap(sim, j)) {
+                sim->downlink.packets++;
+                sim->downlink.delay_sum += i + len - pkt->arrival;
+            }
+            pool_put(&sim->packets, pkt);
+            q->length--;
+        } else {
+            kept = pkt;
+            link = &pkt->next;
+        }
+    }
+    if (q != NULL && *link == NULL) {
+        q->tail = kept;
+    }
+
+    sim->packet_count += sent;
+    sim->lost_frames += frames - sent;
+    sim->transmissions++;
+    if (sim->links != NULL) {
+        sim_feedback(sim, j, frames, sent);
+    }
+    if (sim->energy != NULL) {
+        sim->energy[j].tx += len;
+        sim->energy[j].delivered += sent;
+    }
+    return sent;
+}
+
+/*
+ * Node j got the channel to itself in slot i, with aggregation, frame
+ * errors or TXOPs. Within its TXOP it keeps sending, one SIFS apart, for
+ * as long as the next transmission fits in the TXOP limit, its frames get
+ * through and it has frames left. The first transmission is always sent.
+ * The whole TXOP is one busy period to the other nodes, but the SIFS gaps
+ * in it don't count as transmission slots. A transmission that gets no
+ * frame through has no ACK to show for it, so if the TXOP ends on one the
+ * node doubles its CW as it would after a collision.
+ *
+ * Returns the length of the TXOP.
+ */
+static int
+sim_burst (sim_t *sim, int j, int i)
+{
+    const config_t *cfg = sim->cfg;
+    node_t *node = &sim->nodes[j];
+    int frames, tx, len = 0, sent;
+
+    for (;;) {
+        frames = sim_frames(sim, j);
+        tx = sim_tx_len(sim, j, frames);
+        sent = sim_send(sim, j, i + len, frames, tx);
+        sim_mark(sim, i + len, tx, SLOT_STATE_TRANSMISSION);
+        len += tx;
+
+        if (sent == 0 || sim_frames(sim, j) == 0) {
+            break;
+        }
+        frames = sim_frames(sim, j);
+        if (len + cfg->sifs_slots + sim_tx_len(sim, j, frames) >
+            cfg->txop_slots) {
+            break;
+        }
+        sim_mark(sim, i + len, cfg->sifs_slots, SLOT_STATE_SIFS);
+        len += cfg->sifs_slots;
+    }
+    sim->txops++;
+
+    if (sent == 0) {
+        if (node->cw_size < MAX_BACKOFF_CW) {
+            node->cw_size *= 2;
+        }
+    } else if (cfg->policy == POLICY_RESET) {
+        node->cw_size = cfg->classes[sim_class_of(sim, j)].cw_size;
+    }
+
+    if (sim_frames(sim, j) == 0) {
+        sim_park(sim, j);
+    } else {
+        sim_backoff(sim, j);
+    }
+
+    return len;
+}
+
+/*
+ * Count the slots after slot from up to slot to of a busy period, which
+ * are all of the kind counted by counter except for the SIFS gaps of a
+ * TXOP. Those are only looked for in runs with TXOPs, before the slots are
+ * recycled.
+ */
+static inline void
+sim_count_busy (sim_t *sim, int from, int to, int *counter)
+{
+    int k, gaps = 0;
+
+    if (sim->cfg->txop_slots > 0 && sim->cfg->sifs_slots > 0 &&
+        counter == &sim->transmission_slots) {
+        for (k = from + 1; k <= to; k++) {
+            gaps += (sim_slot(sim, k) == SLOT_STATE_SIFS);
+        }
+        sim->gap_slots += gaps;
+    }
+    *counter += to - from - gaps;
+}
+
+/*
+ * Reset the run to its first slot. If start is NULL, every node starts
+ * afresh with the initial CW of its class. Otherwise the run picks up from the
+ * snapshot.
+ */
+static void
+sim_reset (sim_t *sim, const snapshot_t *start, unsigned int seed)
+{
+    const config_t *cfg = sim->cfg;
+    int i, c, j;
+
+    memset(sim->slots, 0, SLOT_RING_WORDS * sizeof(slot_t));
+
+    if (start != NULL) {
+        for (i = 0; i < cfg->pkt_size; i++) {
+            slot_set(sim->slots, i, start->spill[i]);
+        }
+        memcpy(sim->nodes, start->nodes, cfg->node_count * sizeof(node_t));
+        memcpy(sim->busy, start->busy,
+               NODE_WORDS(cfg->node_count) * sizeof(bitset_t));
+    } else {
+        for (c = 0, i = 0; c < cfg->class_count; c++) {
+            for (j = 0; j < cfg->classes[c].count; j++, i++) {
+                sim->nodes[i].backoff = INVALID_BACKOFF;
+                sim->nodes[i].cw_size = cfg->classes[c].cw_size;
+            }
+        }
+        memset(sim->busy, 0, NODE_WORDS(cfg->node_count) * sizeof(bitset_t));
+    }
+    sim->all_busy = 0;
+    memset(sim->parked, 0, NODE_WORDS(cfg->node_capacity) * sizeof(bitset_t));
+
+    /*
+     * Draw the backoff of every node that doesn't have one yet. Nodes
+     * start with empty queues unless the traffic is saturated.
+     */
+    sim->seed = seed;
+    for (i = 0; i < cfg->node_count; i++) {
+        if (sim->queues != NULL) {
+            sim_flush(sim, i);
+            sim_park(sim, i);
+        } else if (sim->nodes[i].backoff == INVALID_BACKOFF) {
+            sim_backoff(sim, i);
+        }
+    }
+
+    sim->slot = sim->slot_base;
+    sim->idle_slots = 0;
+    sim->collision_slots = 0;
+    sim->transmission_slots = 0;
+    sim->packet_count = 0;
+    sim->prev_efficiency = 0.000001;
+    sim->prev_delta = 1.0;
+
+    sim->node_count = cfg->node_count;
+    for (c = 0, i = 0; c < cfg->class_count; c++) {
+        i += cfg->classes[c].count;
+        sim->class_end[c] = i;
+    }
+    sim->next_churn = 0;
+    sim->next_birth = sim_next_poisson(sim, sim->slot, cfg->birth_rate);
+    sim->next_death = sim_next_poisson(sim, sim->slot,
+                                       cfg->death_rate * sim->node_count);
+    sim->blocked = 0;
+    sim->next_window = (cfg->window > 0) ? sim->slot + cfg->window :
+                                           INT32_MAX;
+    sim->pop_slot = sim->slot;
+    sim->node_slots = 0.0;
+    sim->window_count = 0;
+    sim->next_event = sim->slot;
+
+    for (c = 0; c < cfg->class_count; c++) {
+        sim->rate[c] = 0.0;
+        sim->next_arrival[c] = INT32_MAX;
+    }
+    sim->next_packet = INT32_MAX;
+    sim->next_load = 0;
+    sim->arrivals = 0;
+    sim->drops = 0;
+    sim->delay_sum = 0.0;
+    memset(&sim->downlink, 0, sizeof(sim->downlink));
+    sim->phase_count = 0;
+    sim->lost_frames = 0;
+    sim->txops = 0;
+    sim->transmissions = 0;
+    sim->gap_slots = 0;
+
+    if (sim->energy != NULL) {
+        memset(sim->energy, 0, cfg->node_count * sizeof(energy_t));
+        memset(sim->energy_left, 0, sizeof(sim->energy_left));
+        memset(sim->delivered_left, 0, sizeof(sim->delivered_left));
+    }
+
+    /* Every node dozes until the first beacon, at the start of the run */
+    if (sim->ps != NULL) {
+        for (i = 0; i < cfg->node_count; i++) {
+            sim->ps[i].dozing = 1;
+            sim->ps[i].since = sim->slot;
+            sim->ps[i].pending = 0;
+        }
+    }
+    sim->next_beacon = (cfg->beacon_interval > 0) ? sim->slot : INT32_MAX;
+    sim->beacons = 0;
+    sim->next_probe = sim_next_poisson(sim, sim->slot, cfg->probe_rate);
+    sim->mgmt_due = 0;
+    sim->next_mgmt = sim->slot;
+    sim->mgmt_slots = 0;
+    sim->woken = 0;
+    sim->max_woken = 0;
+    sim->polls = 0;
+    sim->dl_drops = 0;
+    sim->poll_delay = 0.0;
+    sim->burst_left = 0;
+    sim->bursts_closed = 0;
+    sim->burst_slots = 0.0;
+    sim->burst_collisions = 0.0;
+
+    if (sim->links != NULL) {
+        memset(sim->rate_attempts, 0, sizeof(sim->rate_attempts));
+        memset(sim->rate_delivered, 0, sizeof(sim->rate_delivered));
+        for (c = 0, i = 0; c < cfg->class_count; c++) {
+            for (j = 0; j < cfg->classes[c].count; j++, i++) {
+                sim_link(sim, i, c);
+            }
+        }
+    }
+}
+
+/*
+ * We use the following criteria to determine when to stop the
+ * simulation. At each slot boundary, we calculate the efficiency
+ * and store the delta i.e efficiency calculated at this slot minus
+ * the efficiency calculated at the previous slot. We compare this
+ * delta with the delta obtained in the previous iteration. If both
+ * the deltas are less than 0.05%, then we conclude that the
+ * simulation has converged.
+ */
+static int
+sim_converged (sim_t *sim, int i)
+{
+    float cur_efficiency, cur_delta;
+
+    cur_efficiency = (float)sim->transmission_slots / (float)i;
+    cur_delta = (cur_efficiency > sim->prev_efficiency) ?
+                (cur_efficiency - sim->prev_efficiency) :
+                (sim->prev_efficiency - cur_efficiency);
+
+    if (cur_delta < CONVERGENCE_DELTA && sim->prev_delta < CONVERGENCE_DELTA) {
+        return 1;
+    }
+
+    sim->prev_efficiency = cur_efficiency;
+    sim->prev_delta = cur_delta;
+    return 0;
+}
+
+/*
+ * Simulate slots from sim->slot up to (but not including) end. If converge
+ * is set, stop as soon as the efficiency has converged. Returns the slot at
+ * which the run stopped.
+ *
+ * This is the body of every engine instance. pkt_size, size_class and
+ * policy are compile time constants in the specialized instances, which
+ * lets the compiler fold the bounds of the node and busy period loops.
+ *
+ * For each slot, do the following:
+ *
+ * 1. For each node, check if the slot is free. If it is, decrement
+ *    backoff. If backoff expires, transmit the packet.
+ * 2. If the slot is not free, wait till it becomes free and then
+ *    decrement backoff
+ * 3. If 2 nodes simultaneoulsly expire their backoff, then there will
+ *    be a collision for packet-size slots.
+ * 4. In case of a collision, the colliding nodes double their CW size.
+ */
+static inline __attribute__((always_inline)) int
+sim_run_engine (sim_t *sim, int end, int converge, int pkt_size,
+                int size_class, int policy)
+{
+    const config_t *cfg = sim->cfg;
+    node_t *nodes = sim->nodes, *base;
+    bitset_t *busy = sim->busy, *expired = sim->expired, eligible, mask;
+    bitset_t *parked = sim->parked;
+    int words, collision_count, last_word = 0;
+    int i, j, k, w, n, any, state, stop, check, len = pkt_size, *counter;
+
+    words = (size_class == SIZE_CLASS_WORD) ? 1 : NODE_WORDS(sim->node_count);
+
+    for (i = sim->slot; i < end; i++) {
+
+        /*
+         * Entering a new word of the slot ring. The word before it only
+         * holds slots that are done with, so it is recycled as idle slots
+         * at the far end of the ring.
+         */
+        sim_skip(sim, i - 1, i);
+
+        /*
+         * Packets that arrived since the last slot, possibly during a busy
+         * period that was skipped, reach their nodes before the countdown
+         */
+        if (i >= sim->next_packet) {
+            sim_arrivals(sim, i);
+        }
+
+        /* Reset the collision count */
+        collision_count = 0;
+        state = sim_slot(sim, i);
+
+        if (state != SLOT_STATE_IDLE) {
+            /*
+             * When we are decrementing our backoff, some other node's
+             * backoff may expire and it may start transmitting. In such
+             * a case,we should freeze our backoff counter till the other
+             * transmission is complete. To acheive this, we mark every
+             * node as having sensed a busy slot. Consecutive busy slots
+             * leave the bitset as it is.
+             */
+            if (!sim->all_busy) {
+                memset(busy, 0xff, words * sizeof(bitset_t));
+                sim->all_busy = 1;
+            }
+        } else {
+            /*
+             * We need to sense an idle slot for the full slot duration.
+             * Nodes that sensed a busy slot last only clear their flag
+             * here. The rest saw both the current and previous slots
+             * idle and decrement their backoff, unless they are parked.
+             *
+             * The nodes whose backoff expires are collected in the
+             * expired bitset without branching on each node, and the
+             * total count is taken with a popcount per word.
+             */
+            sim->all_busy = 0;
+            for (w = 0; w < words; w++) {
+                eligible = ~(busy[w] | parked[w]);
+                busy[w] = 0;
+                n = sim->node_count - w * NODES_PER_WORD;
+                if (n > NODES_PER_WORD) {
+                    n = NODES_PER_WORD;
+                }
+
+                /*
+                 * Words in which every node is eligible are decremented
+                 * with a plain vector loop. The bitmask is only built for
+                 * the rare words in which some backoff reached zero.
+                 */
+                base = &nodes[w * NODES_PER_WORD];
+                any = 0;
+                if (eligible == ~(bitset_t)0) {
+                    for (k = 0; k < n; k++) {
+                        base[k].backoff -= 1;
+                        any |= (base[k].backoff == 0);
+                    }
+                } else {
+                    for (k = 0; k < n; k++) {
+                        base[k].backoff -= (eligible >> k) & 1;
+                        any |= (base[k].backoff == 0);
+                    }
+                }
+
+                mask = 0;
+                if (any) {
+                    for (k = 0; k < n; k++) {
+                        mask |= (bitset_t)(base[k].backoff == 0) << k;
+                    }
+                }
+
+                expired[w] = mask;
+                collision_count += __builtin_popcountll(mask);
+                last_word = mask ? w : last_word;
+            }
+        }
+
+        /*
+         * We have processed all the nodes. Check the collision count. There
+         * can be 3 cases:
+         *
+         * 1. collision_count = 0: None of the nodes expired their backoff.
+         *    The slot state will either be transmission, collision or idle.
+         * 2. collision_count = 1: Only one guy expired the backoff. This
+         *    indicates successful transmission.
+         * 3. collision_count > 1: Since many guys transmit simultaneously,
+         *    there will be a collision
+         */
+        switch (collision_count) {
+            case 0:
+                /*
+                 * No change in slot state. It will already be set to
+                 * transmission, collision or idle. Nothing to update here.
+                 */
+                break;
+
+            case 1:
+                /* Successful transmission */
+                state = SLOT_STATE_TRANSMISSION;
+                j = last_word * NODES_PER_WORD +
+                    __builtin_ctzll(expired[last_word]);
+                if (sim->bursts) {
+                    len = sim_burst(sim, j, i);
+                    break;
+                }
+                sim_mark(sim, i, pkt_size, SLOT_STATE_TRANSMISSION);
+                len = pkt_size;
+
+                /*
+                 * Redraw the backoff counter of the only expired node,
+                 * going back to the initial CW of its class if the policy
+                 * says so
+                 */
+                if (policy == POLICY_RESET) {
+                    nodes[j].cw_size =
+                        cfg->classes[sim_class_of(sim, j)].cw_size;
+                }
+                if (sim->energy != NULL) {
+                    sim->energy[j].tx += pkt_size;
+                }
+                if (sim->ps != NULL && sim->ps[j].pending > 0) {
+                    sim_poll(sim, j, i + pkt_size);
+                } else {
+                    if (sim->queues != NULL) {
+                        sim_deliver(sim, j, i + pkt_size);
+                    } else {
+                        sim_backoff(sim, j);
+                    }
+
+                    /*
+                     * Update the packet count, and the frames the node
+                     * delivered for the energy it drew. PS-Polls count
+                     * as neither.
+                     */
+                    sim->packet_count++;
+                    if (sim->energy != NULL) {
+                        sim->energy[j].delivered++;
+                    }
+                }
+
+                break;
+
+            default:
+                /*
+                 * Collision. For each colliding node, double the CW size
+                 * and redraw the backoff counter. The collision lasts as
+                 * long as the longest of the colliding transmissions, then
+                 * set the slot state for the affected slots.
+                 */
+                state = SLOT_STATE_COLLISION;
+                len = pkt_size;
+
+                for (w = 0; w <= last_word; w++) {
+                    for (mask = expired[w]; mask; mask &= mask - 1) {
+                        j = w * NODES_PER_WORD + __builtin_ctzll(mask);
+                        n = pkt_size;
+                        if (sim->bursts) {
+                            n = sim_tx_len(sim, j, sim_frames(sim, j));
+                            if (n > len) {
+                                len = n;
+                            }
+                            if (sim->links != NULL) {
+                                sim_feedback(sim, j, sim_frames(sim, j), 0);
+                            }
+                        }
+                        if (sim->energy != NULL) {
+                            sim->energy[j].tx += n;
+                        }
+                        if (nodes[j].cw_size < MAX_BACKOFF_CW) {
+                            nodes[j].cw_size *= 2;
+                        }
+                        sim_backoff(sim, j);
+                    }
+                }
+                sim_mark(sim, i, len, SLOT_STATE_COLLISION);
+
+                break;
+        }
+
+        /* Collect Statistics */
+        if (state == SLOT_STATE_IDLE) {
+            sim->idle_slots++;
+        } else if (state == SLOT_STATE_TRANSMISSION) {
+            sim->transmission_slots++;
+        } else if (state == SLOT_STATE_COLLISION) {
+            sim->collision_slots++;
+        } else if (state == SLOT_STATE_SIFS) {
+            sim->gap_slots++;
+        } else {
+            sim->mgmt_slots++;
+        }
+
+        if (converge && ((i % CONVERGENCE_INTERVAL) == 0) && (i != 0) &&
+            sim_converged(sim, i)) {
+            break;
+        }
+
+        /*
+         * A transmission started in this slot. All nodes stay frozen for
+         * the rest of the busy period, so its slots are only counted,
+         * stopping at a convergence check if one falls inside.
+         */
+        if (collision_count > 0 && len > 1) {
+            stop = (i + len < end) ? i + len : end;
+            if (stop > i + 1) {
+                if (!sim->all_busy) {
+                    memset(busy, 0xff, words * sizeof(bitset_t));
+                    sim->all_busy = 1;
+                }
+                counter = (state == SLOT_STATE_TRANSMISSION) ?
+                          &sim->transmission_slots : &sim->collision_slots;
+
+                check = (i / CONVERGENCE_INTERVAL + 1) * CONVERGENCE_INTERVAL;
+                if (converge && check < stop) {
+                    sim_count_busy(sim, i, check, counter);
+                    sim_skip(sim, i, check);
+                    i = check;
+                    if (sim_converged(sim, i)) {
+                        break;
+                    }
+                }
+
+                sim_count_busy(sim, i, stop - 1, counter);
+                sim_skip(sim, i, stop - 1);
+                i = stop - 1;
+            }
+        }
+    }
+
+    sim->slot = i;
+    return i;
+}
+
+/* Generic engine, used when no specialized instance matches */
+static int
+sim_run_generic (sim_t *sim, int end, int converge)
+{
+    return sim_run_engine(sim, end, converge, sim->cfg->pkt_size,
+                          SIZE_CLASS_ANY, sim->cfg->policy);
+}
+
+#define ENGINE_DEFINE(pkt, class, policy)                                   \
+static int                                                                  \
+sim_run_##pkt##_##class##_##policy (sim_t *sim, int end, int converge)      \
+{                                                                           \
+    return sim_run_engine(sim, end, converge, pkt, SIZE_CLASS_##class,      \
+                          POLICY_##policy);                                 \
+}
+
+#define ENGINE_ENTRY(pkt, class, policy)                                    \
+    { pkt, SIZE_CLASS_##class, POLICY_##policy,                             \
+      sim_run_##pkt##_##class##_##policy },
+
+ENGINE_SPECIALIZATIONS(ENGINE_DEFINE)
+
+static const engine_t engines[] = {
+    ENGINE_SPECIALIZATIONS(ENGINE_ENTRY)
+    { 0, SIZE_CLASS_ANY, 0, sim_run_generic }
+};
+
+/*
+ * Pick the engine instance for a configuration. The table is ordered from
+ * the smallest size class up, and the generic engine at the end matches
+ * everything.
+ */
+static engine_fn
+engine_select (const config_t *cfg)
+{
+    const engine_t *engine;
+    int size_class = size_class_of(cfg->node_capacity);
+
+    for (engine = engines; engine->run != sim_run_generic; engine++) {
+        if (engine->pkt_size == cfg->pkt_size &&
+            engine->size_class >= size_class &&
+            engine->policy == cfg->policy) {
+            break;
+        }
+    }
+
+    return engine->run;
+}
+
+/*
+ * Copy the bit of node from in a node bitset to node to
+ */
+static inline void
+bit_copy (bitset_t *set, int from, int to)
+{
+    bitset_t bit = (set[from / NODES_PER_WORD] >> (from % NODES_PER_WORD)) & 1;
+
+    set[to / NODES_PER_WORD] =
+        (set[to / NODES_PER_WORD] & ~((bitset_t)1 << (to % NODES_PER_WORD))) |
+        (bit << (to % NODES_PER_WORD));
+}
+
+/*
+ * Move node from to the place of node to, along with its busy and parked
+ * flags, its queue, its link, its energy record and its power-save state
+ */
+static inline void
+sim_move (sim_t *sim, int from, int to)
+{
+    sim->nodes[to] = sim->nodes[from];
+    bit_copy(sim->busy, from, to);
+    bit_copy(sim->parked, from, to);
+    if (sim->queues != NULL) {
+        sim->queues[to] = sim->queues[from];
+    }
+    if (sim->links != NULL) {
+        sim->links[to] = sim->links[from];
+    }
+    if (sim->energy != NULL) {
+        sim->energy[to] = sim->energy[from];
+    }
+    if (sim->ps != NULL) {
+        sim->ps[to] = sim->ps[from];
+    }
+}
+
+/*
+ * Add a node to class c. The first node of every later class moves to the
+ * end of that class to make room, so the cost depends on the number of
+ * classes only. The new node has to sense an idle slot before it counts
+ * down, and has nothing to send yet unless the traffic is saturated.
+ * Returns 0 if the node capacity is reached.
+ */
+static int
+sim_join (sim_t *sim, int c)
+{
+    const config_t *cfg = sim->cfg;
+    int d, j = sim->node_count;
+
+    if (sim->node_count == cfg->node_capacity) {
+        sim->blocked++;
+        return 0;
+    }
+
+    for (d = cfg->class_count - 1; d > c; d--) {
+        if (sim->class_end[d] > sim->class_end[d - 1]) {
+            sim_move(sim, sim->class_end[d - 1], j);
+            j = sim->class_end[d - 1];
+        }
+        sim->class_end[d]++;
+    }
+    sim->class_end[c]++;
+    sim->node_count++;
+
+    sim->nodes[j].cw_size = cfg->classes[c].cw_size;
+    if (sim->queues != NULL) {
+        memset(&sim->queues[j], 0, sizeof(queue_t));
+        sim_park(sim, j);
+    } else {
+        sim_backoff(sim, j);
+    }
+    if (sim->links != NULL) {
+        sim_link(sim, j, c);
+    }
+    if (sim->energy != NULL) {
+        memset(&sim->energy[j], 0, sizeof(energy_t));
+        sim->energy[j].idle_base = sim->idle_slots;
+        sim->energy[j].busy_base = sim->transmission_slots +
+                                   sim->collision_slots + sim->mgmt_slots +
+                                   sim->gap_slots;
+    }
+    if (sim->ps != NULL) {
+        sim->ps[j].dozing = 1;
+        sim->ps[j].since = sim->slot;
+        sim->ps[j].pending = 0;
+    }
+    sim->busy[j / NODES_PER_WORD] |= (bitset_t)1 << (j % NODES_PER_WORD);
+    sim->all_busy = 0;
+    return 1;
+}
+
+/*
+ * Remove node j, dropping whatever it had queued and keeping the energy it
+ * used with its class. The last node of its class takes its place, and the
+ * last node of every later class fills the hole left at the end of the
+ * class before it.
+ */
+static void
+sim_leave (sim_t *sim, int j)
+{
+    const config_t *cfg = sim->cfg;
+    int c = sim_class_of(sim, j), d;
+    double slots[ENERGY_STATES];
+
+    if (sim->queues != NULL) {
+        sim_flush(sim, j);
+    }
+    if (sim->energy != NULL) {
+        sim_energy(sim, j, slots);
+        for (d = 0; d < ENERGY_STATES; d++) {
+            sim->energy_left[c][d] += slots[d];
+        }
+        sim->delivered_left[c] += sim->energy[j].delivered;
+    }
+
+    for (d = c; d < cfg->class_count; d++) {
+        if (sim->class_end[d] - 1 != j) {
+            sim_move(sim, sim->class_end[d] - 1, j);
+        }
+        j = sim->class_end[d] - 1;
+        sim->class_end[d]--;
+    }
+    sim->parked[j / NODES_PER_WORD] &= ~((bitset_t)1 << (j % NODES_PER_WORD));
+    sim->node_count--;
+    sim->all_busy = 0;
+}
+
+/*
+ * Record the statistics of the window or phase that ends at slot i
+ */
+static void
+sim_record (sim_t *sim, window_t *win, int i)
+{
+    sim->node_slots += (double)sim->node_count * (i - sim->pop_slot);
+    sim->pop_slot = i;
+
+    win->slot = i;
+    win->node_count = sim->node_count;
+    win->node_slots = sim->node_slots;
+    win->idle_slots = sim->idle_slots;
+    win->collision_slots = sim->collision_slots;
+    win->transmission_slots = sim->transmission_slots;
+    win->packet_count = sim->packet_count;
+    win->arrivals = sim->arrivals;
+    win->drops = sim->drops;
+    win->delay_sum = sim->delay_sum;
+}
+
+/*
+ * Close the load phase that ends at slot i, unless it is empty
+ */
+static void
+sim_phase (sim_t *sim, int i)
+{
+    int start = sim->phase_count ?
+                sim->phases[sim->phase_count - 1].slot : sim->slot_base;
+
+    if (i > start) {
+        sim_record(sim, &sim->phases[sim->phase_count++], i);
+    }
+}
+
+/*
+ * Packets per slot that reach the nodes of class c. The AP gets the
+ * downlink frames of every other node.
+ */
+static double
+sim_offered (const sim_t *sim, int c)
+{
+    int start = (c > 0) ? sim->class_end[c - 1] : 0;
+
+    if (c == sim->cfg->ap_class) {
+        return sim->rate[c] * sim_stations(sim);
+    }
+    return sim->rate[c] * (sim->class_end[c] - start);
+}
+
+/*
+ * Send a packet that arrived in slot i to a random node of class c
+ */
+static void
+sim_arrive (sim_t *sim, int c, int i)
+{
+    int start = (c > 0) ? sim->class_end[c - 1] : 0;
+
+    if (sim->class_end[c] > start) {
+        sim_enqueue(sim, start + rand_r(&sim->seed) %
+                                 (sim->class_end[c] - start), i);
+    }
+}
+
+/*
+ * Take in every packet that arrived by slot i, in the order of arrival, and
+ * work out when the next one is due
+ */
+static void
+sim_arrivals (sim_t *sim, int i)
+{
+    int c, first;
+
+    for (;;) {
+        first = 0;
+        for (c = 1; c < sim->cfg->class_count; c++) {
+            if (sim->next_arrival[c] < sim->next_arrival[first]) {
+                first = c;
+            }
+        }
+        if (sim->next_arrival[first] > i) {
+            break;
+        }
+        sim_arrive(sim, first, sim->next_arrival[first]);
+        sim->next_arrival[first] =
+            sim_next_poisson(sim, sim->next_arrival[first],
+                             sim_offered(sim, first));
+    }
+
+    sim->next_packet = sim->next_arrival[first];
+}
+
+/*
+ * The AP has management frames waiting at slot i. It sends them as soon as
+ * the channel is idle, in one busy period of up to MAX_TX_SLOTS, and
+ * otherwise comes back at the first idle slot.
+ */
+static void
+sim_manage (sim_t *sim, int i)
+{
+    int j, len;
+
+    for (j = i; sim_slot(sim, j) != SLOT_STATE_IDLE; j++);
+    if (j > i) {
+        sim->next_mgmt = j;
+        return;
+    }
+
+    len = (sim->mgmt_due < MAX_TX_SLOTS) ? sim->mgmt_due : MAX_TX_SLOTS;
+    sim_mark(sim, i, len, SLOT_STATE_MANAGEMENT);
+    sim->mgmt_due -= len;
+    sim->next_mgmt = i + len;
+}
+
+/*
+ * Apply every population change, beacon, load change and packet arrival
+ * and close every stats window that is due at the current slot, then work
+ * out when the next one is due. New nodes join a class in proportion to its
+ * initial size, and departures pick a node at random. The AP neither joins
+ * nor leaves. The departure and packet arrival processes are redrawn
+ * whenever their rate changes, which is valid as they are memoryless.
+ */
+static void
+sim_events (sim_t *sim)
+{
+    const config_t *cfg = sim->cfg;
+    const churn_t *ev;
+    int i = sim->slot, c, k, start, changed = 0, reload = 0;
+
+    /* The engine may have stopped inside a busy period it skipped */
+    sim_arrivals(sim, i - 1);
+
+    while (sim->next_window <= i) {
+        sim_record(sim, &sim->windows[sim->window_count++],
+                   sim->next_window);
+        sim->next_window += cfg->window;
+    }
+
+    sim->node_slots += (double)sim->node_count * (i - sim->pop_slot);
+    sim->pop_slot = i;
+
+    while (sim->next_churn < cfg->churn_count &&
+           cfg->churn[sim->next_churn].slot <= i) {
+        ev = &cfg->churn[sim->next_churn++];
+        c = ev->class_index;
+        for (k = 0; k < ev->delta && sim_join(sim, c); k++);
+        for (k = 0; k < -ev->delta; k++) {
+            start = (c > 0) ? sim->class_end[c - 1] : 0;
+            if (sim->class_end[c] == start) {
+                break;
+            }
+            sim_leave(sim, start + rand_r(&sim->seed) %
+                                   (sim->class_end[c] - start));
+        }
+        changed = 1;
+    }
+
+    while (sim->next_birth <= i) {
+        k = rand_r(&sim->seed) % (cfg->node_count - (cfg->ap_class >= 0));
+        for (c = 0; k >= cfg->classes[c].count; c++) {
+            k -= cfg->classes[c].count;
+        }
+        sim_join(sim, c);
+        sim->next_birth = sim_next_poisson(sim, sim->next_birth,
+                                           cfg->birth_rate);
+        changed = 1;
+    }
+
+    if (sim->next_death <= i && sim_stations(sim) > 0) {
+        sim_leave(sim, rand_r(&sim->seed) % sim_stations(sim));
+        changed = 1;
+    }
+    if (changed) {
+        sim->next_death = sim_next_poisson(sim, i,
+                                           cfg->death_rate *
+                                           sim_stations(sim));
+    }
+
+    while (sim->next_beacon <= i) {
+        if (sim->ps != NULL) {
+            sim_beacon(sim, sim->next_beacon);
+        }
+        sim->mgmt_due += cfg->ssid_count * cfg->beacon_slots;
+        sim->beacons++;
+        sim->next_beacon += cfg->beacon_interval;
+    }
+    while (sim->next_probe <= i) {
+        sim->mgmt_due += cfg->probe_slots;
+        sim->next_probe = sim_next_poisson(sim, sim->next_probe,
+                                           cfg->probe_rate);
+    }
+    if (sim->mgmt_due > 0 && sim->next_mgmt <= i) {
+        sim_manage(sim, i);
+    }
+
+    sim_arrivals(sim, i);
+
+    if (sim->next_load < cfg->load_count &&
+        cfg->load[sim->next_load].slot <= i) {
+        sim_phase(sim, i);
+        while (sim->next_load < cfg->load_count &&
+               cfg->load[sim->next_load].slot <= i) {
+            sim->rate[cfg->load[sim->next_load].class_index] =
+                cfg->load[sim->next_load].rate;
+            sim->next_load++;
+        }
+        reload = 1;
+    }
+    if (changed || reload) {
+        for (c = 0; c < cfg->class_count; c++) {
+            sim->next_arrival[c] = sim_next_poisson(sim, i,
+                                                    sim_offered(sim, c));
+        }
+        sim_arrivals(sim, i);
+    }
+
+    sim->next_event = sim->next_window;
+    if (sim->next_beacon < sim->next_event) {
+        sim->next_event = sim->next_beacon;
+    }
+    if (sim->next_probe < sim->next_event) {
+        sim->next_event = sim->next_probe;
+    }
+    if (sim->mgmt_due > 0 && sim->next_mgmt < sim->next_event) {
+        sim->next_event = sim->next_mgmt;
+    }
+    if (sim->next_load < cfg->load_count &&
+        cfg->load[sim->next_load].slot < sim->next_event) {
+        sim->next_event = cfg->load[sim->next_load].slot;
+    }
+    if (sim->next_churn < cfg->churn_count &&
+        cfg->churn[sim->next_churn].slot < sim->next_event) {
+        sim->next_event = cfg->churn[sim->next_churn].slot;
+    }
+    if (sim->next_birth < sim->next_event) {
+        sim->next_event = sim->next_birth;
+    }
+    if (sim->next_death < sim->next_event) {
+        sim->next_event = sim->next_death;
+    }
+}
+
+/*
+ * Simulate slots from sim->slot up to end, see sim_run_engine. Dynamic runs
+ * go through the engine in stretches that end at the next population
+ * change or window boundary, so the engines only ever see a fixed set of
+ * nodes. The last window is closed wherever the run stops.
+ */
+static int
+sim_run (sim_t *sim, int end, int converge)
+{
+    int i, stop;
+
+    if (!sim->dynamic) {
+        return sim->engine(sim, end, converge);
+    }
+
+    for (;;) {
+        if (sim->slot >= sim->next_event) {
+            sim_events(sim);
+        }
+        stop = (sim->next_event < end) ? sim->next_event : end;
+        i = sim->engine(sim, stop, converge);
+        if (i < stop || stop == end) {
+            break;
+        }
+    }
+    sim_arrivals(sim, i - 1);
+
+    if (sim->windows != NULL &&
+        (sim->window_count == 0 ||
+         sim->windows[sim->window_count - 1].slot < i)) {
+        sim_record(sim, &sim->windows[sim->window_count++], i);
+    }
+    if (sim->phases != NULL) {
+        sim_phase(sim, i);
+    }
+    return i;
+}
+
+/*
+ * Split the traffic of a run into its uplink and downlink flows
+ */
+static void
+sim_flows (const sim_t *sim, flow_t *flows)
+{
+    flows[FLOW_DOWNLINK] = sim->downlink;
+    flows[FLOW_UPLINK].packets = sim->packet_count - sim->downlink.packets;
+    flows[FLOW_UPLINK].arrivals = sim->arrivals - sim->downlink.arrivals;
+    flows[FLOW_UPLINK].drops = sim->drops - sim->downlink.drops;
+    flows[FLOW_UPLINK].delay_sum = sim->delay_sum - sim->downlink.delay_sum;
+}
+
+/*
+ * Per idle slot transmission probability of a node whose CW is cw_size. The
+ * backoff is uniform in [1, cw_size], so a node transmits once every
+ * (cw_size + 1) / 2 idle slots on average.
+ */
+static double
+cw_tau (double cw_size)
+{
+    return 2.0 / (cw_size + 1.0);
+}
+
+/*
+ * Coarse propagator for parareal. Advances the fraction of nodes in each
+ * backoff stage by the given number of slots, using the mean collision
+ * probability of each stage instead of simulating individual nodes.
+ */
+static void
+coarse_predict (const config_t *cfg, double *hist, int slot_count)
+{
+    double tau[MAX_BACKOFF_STAGE], log_idle, p_idle, busy_len, vslots, flow;
+    double carry;
+    int stage, step;
+
+    busy_len = cfg->pkt_size + (cfg->pkt_size > 1 ? 1 : 0);
+    for (stage = 0; stage < MAX_BACKOFF_STAGE; stage++) {
+        tau[stage] = cw_tau((double)cfg->cw_size * pow(2.0, stage));
+    }
+
+    for (step = 0; step < slot_count; step += COARSE_STEP) {
+        log_idle = 0.0;
+        for (stage = 0; stage < MAX_BACKOFF_STAGE; stage++) {
+            log_idle += hist[stage] * cfg->node_count * log(1.0 - tau[stage]);
+        }
+        p_idle = exp(log_idle);
+
+        /* Number of idle or busy periods that fit in this step */
+        vslots = COARSE_STEP / (p_idle + (1.0 - p_idle) * busy_len);
+
+        carry = 0.0;
+        for (stage = 0; stage < MAX_BACKOFF_STAGE - 1; stage++) {
+            flow = hist[stage] * tau[stage] * vslots *
+                   (1.0 - exp(log_idle - log(1.0 - tau[stage])));
+            if (flow > hist[stage]) {
+                flow = hist[stage];
+            }
+            hist[stage] += carry - flow;
+            carry = flow;
+        }
+        hist[stage] += carry;
+    }
+}
+
+/*
+ * Build a node state with the given stage histogram. Backoff counters are
+ * left to be drawn when the nodes first sense an idle slot.
+ */
+static void
+predict_nodes (const config_t *cfg, const double *hist, node_t *nodes)
+{
+    double cumulative = hist[0];
+    int i, stage = 0;
+
+    for (i = 0; i < cfg->node_count; i++) {
+        while (stage < MAX_BACKOFF_STAGE - 1 &&
+               (i + 0.5) / cfg->node_count > cumulative) {
+            cumulative += hist[++stage];
+        }
+        nodes[i].backoff = INVALID_BACKOFF;
+        nodes[i].cw_size = cfg->cw_size << stage;
+        if (nodes[i].cw_size > MAX_BACKOFF_CW || nodes[i].cw_size <= 0) {
+            nodes[i].cw_size = MAX_BACKOFF_CW;
+        }
+    }
+}
+
+/*
+ * Aggregate attempt rate of a node state i.e. the expected number of
+ * transmissions per idle slot. This is what decides the idle, success and
+ * collision probabilities of the slots that follow.
+ */
+static double
+attempt_rate (const config_t *cfg, const node_t *nodes)
+{
+    double rate = 0.0;
+    int i;
+
+    for (i = 0; i < cfg->node_count; i++) {
+        rate += cw_tau(nodes[i].cw_size);
+    }
+
+    return rate;
+}
+
+/*
+ * Relative divergence of a predicted state from the actual one
+ */
+static double
+state_distance (const config_t *cfg, const node_t *predicted,
+                const node_t *actual)
+{
+    double rate = attempt_rate(cfg, actual);
+
+    return fabs(attempt_rate(cfg, predicted) - rate) / rate;
+}
+
+/*
+ * Pin the calling worker thread to the worker-th CPU it is allowed to run on.
+ * Threads are left unpinned if the allowed CPUs couldn't be found out.
+ */
+static void
+pin_worker (int worker)
+{
+    cpu_set_t set;
+    int cpu, n, count = CPU_COUNT(&cpus);
+
+    if (count == 0) {
+        return;
+    }
+
+    n = worker % count;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpus) && n-- == 0) {
+            break;
+        }
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *
+segment_thread (void *arg)
+{
+    segment_t *seg = arg;
+
+    /*
+     * Every pass of a segment runs on the same CPU when pinning. The first
+     * run allocates the segment state from the thread's arena, so it is
+     * first touched there.
+     */
+    if (seg->cfg->pin) {
+        pin_worker(seg->index);
+    }
+    if (seg->sim.cfg == NULL) {
+        sim_alloc(&seg->sim, &seg->arena, seg->cfg, seg->first,
+                  seg->last - seg->first);
+    }
+
+    sim_reset(&seg->sim, seg->start, seg->seed);
+    sim_run(&seg->sim, seg->last, 0);
+
+    return NULL;
+}
+
+/*
+ * Make segment k start from where segment k - 1 ended
+ */
+static void
+segment_inherit (const config_t *cfg, pool_t *pool, segment_t *segs, int k)
+{
+    sim_t *left = &segs[k - 1].sim;
+    snapshot_t *snap = snapshot_get(pool, cfg);
+    int i;
+
+    memcpy(snap->nodes, left->nodes, cfg->node_count * sizeof(node_t));
+    memcpy(snap->busy, left->busy,
+           NODE_WORDS(cfg->node_count) * sizeof(bitset_t));
+    for (i = 0; i < cfg->pkt_size; i++) {
+        snap->spill[i] = slot_get(left->slots, left->slot_count + i);
+    }
+
+    pool_put(pool, segs[k].start);
+    segs[k].start = snap;
+    segs[k].dirty = 1;
+}
+
+/*
+ * Time-parallel (parareal style) run of a fixed slot horizon. The horizon is
+ * split into segments that are simulated concurrently, each starting from a
+ * state predicted by the coarse propagator. After every pass, segments
+ * whose starting stage histogram diverges from the end state of their left
+ * neighbour by more than the tolerance are restarted from that end state.
+ * Once the boundaries agree, the per-segment statistics are summed up.
+ *
+ * Returns the number of correction passes and fills in the totals in out.
+ */
+static int
+parareal_run (const config_t *cfg, arena_t *arena, sim_t *out,
+              int *corrections)
+{
+    segment_t *segs;
+    pool_t pool;
+    double hist[MAX_BACKOFF_STAGE];
+    int seg_count = cfg->segment_count;
+    int iteration = 0, corrected, k;
+
+    segs = arena_alloc(arena, seg_count * sizeof(segment_t));
+    memset(segs, 0, seg_count * sizeof(segment_t));
+    snapshot_pool_init(&pool, arena, cfg);
+
+    /* Predict the starting state of every segment */
+    memset(hist, 0, sizeof(hist));
+    hist[0] = 1.0;
+    for (k = 0; k < seg_count; k++) {
+        /* config_valid keeps every segment at least a slot long */
+        segs[k].first = (long)cfg->slot_size * k / seg_count;
+        segs[k].last = (long)cfg->slot_size * (k + 1) / seg_count;
+        segs[k].cfg = cfg;
+        segs[k].index = k;
+        segs[k].dirty = 1;
+        segs[k].start = snapshot_get(&pool, cfg);
+
+        predict_nodes(cfg, hist, segs[k].start->nodes);
+        coarse_predict(cfg, hist, segs[k].last - segs[k].first);
+    }
+
+    *corrections = 0;
+    do {
+        /* Run every dirty segment in parallel */
+        for (k = 0; k < seg_count; k++) {
+            if (segs[k].dirty) {
+                segs[k].seed = cfg->seed ^ (k * 2654435761u) ^
+                               (iteration * 40503u);
+                pthread_create(&segs[k].thread, NULL, segment_thread,
+                               &segs[k]);
+            }
+        }
+        for (k = 0; k < seg_count; k++) {
+            if (segs[k].dirty) {
+                pthread_join(segs[k].thread, NULL);
+                segs[k].dirty = 0;
+            }
+        }
+        iteration++;
+
+        /* Correct the segments whose boundary state diverged */
+        corrected = 0;
+        for (k = 1; k < seg_count; k++) {
+            if (state_distance(cfg, segs[k].start->nodes,
+                               segs[k - 1].sim.nodes) > cfg->tolerance) {
+                segment_inherit(cfg, &pool, segs, k);
+                corrected++;
+            }
+        }
+        *corrections += corrected;
+    } while (corrected && iteration < cfg->max_iterations);
+
+    if (corrected) {
+        /*
+         * Out of iterations. Fall back to sequential execution from the
+         * first segment that is still inconsistent.
+         */
+        for (k = 1; k < seg_count && !segs[k].dirty; k++);
+        for (; k < seg_count; k++) {
+            segment_inherit(cfg, &pool, segs, k);
+            segment_thread(&segs[k]);
+        }
+    }
+
+    memset(out, 0, sizeof(*out));
+    for (k = 0; k < seg_count; k++) {
+        out->idle_slots += segs[k].sim.idle_slots;
+        out->transmission_slots += segs[k].sim.transmission_slots;
+        out->collision_slots += segs[k].sim.collision_slots;
+        out->packet_count += segs[k].sim.packet_count;
+        arena_free(&segs[k].arena);
+    }
+    out->slot = cfg->slot_size;
+
+    return iteration;
+}
+
+/*
+ * Sample from Binomial(n, p), conditioned on the result being at least one
+ * if at_least_one is set. Small means are sampled exactly by inversion,
+ * large ones with a normal approximation so the cost stays bounded.
+ */
+static int
+binomial (unsigned int *seed, int n, double p, int at_least_one)
+{
+    double mean = n * p, pmf, cdf, u;
+    int k;
+
+    if (n == 0) {
+        return 0;
+    }
+    if (p >= 1.0) {
+        return n;
+    }
+
+    if (mean > 50.0) {
+        u = sqrt(-2.0 * log(uniform(seed))) * cos(2.0 * M_PI * uniform(seed));
+        k = (int)floor(mean + u * sqrt(mean * (1.0 - p)) + 0.5);
+        return (k < at_least_one) ? at_least_one : ((k > n) ? n : k);
+    }
+
+    pmf = exp(n * log1p(-p));
+    cdf = pmf;
+    u = uniform(seed);
+    if (at_least_one) {
+        u = pmf + u * (1.0 - pmf);
+    }
+
+    for (k = 0; u > cdf && k < n; k++) {
+        pmf *= (double)(n - k) / (k + 1) * p / (1.0 - p);
+        cdf += pmf;
+    }
+
+    return k;
+}
+
+/*
+ * Approximate engine for quick studies. Instead of tracking backoff
+ * counters, every node is taken to be p-persistent: in each idle slot it
+ * transmits with the probability tau implied by its current CW. Nodes with
+ * the same CW are then interchangeable, so the state is just the number of
+ * nodes of each class in each backoff stage, kept in one bin per (class,
+ * stage) pair. Each busy period is simulated as one event:
+ *
+ * 1. The number of idle slots before the next transmission attempt is
+ *    drawn from a geometric distribution.
+ * 2. The number of transmitters in each bin is drawn from a binomial,
+ *    conditioned on there being at least one transmitter overall.
+ * 3. A single transmitter is a success, and goes back to the first stage
+ *    of its class under POLICY_RESET. Otherwise every transmitter moves up
+ *    a stage, doubling its CW.
+ *
+ * The cost of an event depends on the number of bins, not of nodes.
+ */
+static int
+approx_run (const config_t *cfg, sim_t *out, int end, int converge)
+{
+    int count[MAX_NODE_CLASSES * MAX_BACKOFF_STAGE];
+    int sent[MAX_NODE_CLASSES * MAX_BACKOFF_STAGE];
+    double tau[MAX_NODE_CLASSES * MAX_BACKOFF_STAGE];
+    double log_idle[MAX_NODE_CLASSES * MAX_BACKOFF_STAGE + 1];
+    double p_zero, p_rest;
+    int bins = cfg->class_count * MAX_BACKOFF_STAGE, last = 0;
+    int dead = 0, next_check = CONVERGENCE_INTERVAL;
+    int i = 0, gap, busy, bin, total, need;
+
+    memset(out, 0, sizeof(*out));
+    out->cfg = cfg;
+    out->seed = cfg->seed;
+    out->prev_efficiency = 0.000001;
+    out->prev_delta = 1.0;
+
+    memset(count, 0, sizeof(count));
+    for (bin = 0; bin < bins; bin++) {
+        if (bin % MAX_BACKOFF_STAGE == 0) {
+            count[bin] = cfg->classes[bin / MAX_BACKOFF_STAGE].count;
+        }
+        tau[bin] = cw_tau((double)cfg->classes[bin / MAX_BACKOFF_STAGE].cw_size *
+                          pow(2.0, bin % MAX_BACKOFF_STAGE));
+        if (tau[bin] > 1.0) {
+            tau[bin] = 1.0;
+        }
+    }
+
+    while (i < end) {
+        /*
+         * log_idle[b] is the log probability that no node in bin b or
+         * above transmits in an idle slot
+         */
+        log_idle[bins] = 0.0;
+        for (bin = bins - 1; bin >= 0; bin--) {
+            log_idle[bin] = log_idle[bin + 1] +
+                            (count[bin] ? count[bin] * log1p(-tau[bin]) : 0.0);
+        }
+
+        /*
+         * Idle slots: the one following a busy period, in which nobody may
+         * decrement, and the geometric run before the next attempt
+         */
+        if (log_idle[0] == 0.0) {
+            gap = end - i;
+        } else if (isinf(log_idle[0])) {
+            gap = dead;
+        } else {
+            gap = dead + (int)fmin(floor(log(uniform(&out->seed)) /
+                                         log_idle[0]), end - i);
+        }
+        if (gap > end - i) {
+            gap = end - i;
+        }
+        out->idle_slots += gap;
+        i += gap;
+        if (i >= end) {
+            break;
+        }
+
+        /* Transmitters per bin, at least one in total */
+        total = 0;
+        need = 1;
+        for (bin = 0; bin < bins; bin++) {
+            sent[bin] = 0;
+            if (count[bin] == 0) {
+                continue;
+            }
+            if (need) {
+                p_zero = exp(count[bin] * log1p(-tau[bin]));
+                p_rest = exp(log_idle[bin + 1]);
+                if (uniform(&out->seed) <
+                    p_zero * (1.0 - p_rest) / (1.0 - exp(log_idle[bin]))) {
+                    continue;
+                }
+            }
+            sent[bin] = binomial(&out->seed, count[bin], tau[bin], need);
+            total += sent[bin];
+            if (sent[bin] > 0) {
+                last = bin;
+            }
+            need = 0;
+        }
+
+        busy = (cfg->pkt_size < end - i) ? cfg->pkt_size : end - i;
+        if (total == 1) {
+            out->transmission_slots += busy;
+            out->packet_count++;
+            if (cfg->policy == POLICY_RESET) {
+                count[last]--;
+                count[last - last % MAX_BACKOFF_STAGE]++;
+            }
+        } else {
+            out->collision_slots += busy;
+            for (bin = bins - 1; bin >= 0; bin--) {
+                if (bin % MAX_BACKOFF_STAGE != MAX_BACKOFF_STAGE - 1) {
+                    count[bin] -= sent[bin];
+                    count[bin + 1] += sent[bin];
+                }
+            }
+        }
+        i += busy;
+        dead = (cfg->pkt_size > 1) ? 1 : 0;
+
+        /*
+         * The tallies already run to i, a gap or busy period past the
+         * check, so that is where the run stops
+         */
+        if (converge && next_check < i && i < end) {
+            if (sim_converged(out, i)) {
+                out->slot = i;
+                return i;
+            }
+            while (next_check < i) {
+                next_check += CONVERGENCE_INTERVAL;
+            }
+        }
+    }
+
+    out->slot = end;
+    return end;
+}
+
+/*
+ * UORA engine. The time is a sequence of trigger cycles of trigger_slots +
+ * pkt_size slots, and each RU of a cycle counts as a channel of its own, so
+ * the slot counts are in RU slots: ru_count per slot of the run. The
+ * trigger frame counts as idle on every RU. In each cycle:
+ *
+ * 1. Every node whose OFDMA backoff (OBO) is at most ru_count transmits on
+ *    an RU of its choice. The others count their OBO down by ru_count.
+ * 2. An RU with a single transmitter is a success, one with several a
+ *    collision.
+ * 3. The transmitters draw a new OBO from their OCW, after doubling it on
+ *    a collision or, under POLICY_RESET, going back to the initial OCW of
+ *    their class on a success.
+ */
+static int
+uora_run (const config_t *cfg, arena_t *arena, sim_t *out, int end,
+          int converge)
+{
+    int senders[MAX_RUS];
+    int ru = cfg->ru_count, cycle = cfg->trigger_slots + cfg->pkt_size;
+    int next_check = CONVERGENCE_INTERVAL, i = 0, tx_count;
+    int c, j, k, r, len, data, *tx, *pick;
+    node_t *nodes;
+
+    memset(out, 0, sizeof(*out));
+    out->cfg = cfg;
+    out->seed = cfg->seed;
+    out->prev_efficiency = 0.000001;
+    out->prev_delta = 1.0;
+    out->node_count = cfg->node_count;
+    out->nodes = nodes = arena_alloc(arena, cfg->node_count * sizeof(node_t));
+    tx = arena_alloc(arena, cfg->node_count * sizeof(int));
+    pick = arena_alloc(arena, cfg->node_count * sizeof(int));
+
+    for (c = 0, j = 0; c < cfg->class_count; c++) {
+        for (k = 0; k < cfg->classes[c].count; k++, j++) {
+            nodes[j].cw_size = cfg->classes[c].cw_size;
+            nodes[j].backoff = rand_r(&out->seed) % nodes[j].cw_size;
+        }
+        out->class_end[c] = j;
+    }
+
+    while (i < end) {
+        memset(senders, 0, ru * sizeof(int));
+        tx_count = 0;
+        for (j = 0; j < cfg->node_count; j++) {
+            if (nodes[j].backoff > ru) {
+                nodes[j].backoff -= ru;
+                continue;
+            }
+            r = rand_r(&out->seed) % ru;
+            senders[r]++;
+            tx[tx_count] = j;
+            pick[tx_count++] = r;
+        }
+
+        len = (cycle < end - i) ? cycle : end - i;
+        data = (len > cfg->trigger_slots) ? len - cfg->trigger_slots : 0;
+        out->idle_slots += ru * (len - data);
+        for (r = 0; r < ru; r++) {
+            if (senders[r] == 0) {
+                out->idle_slots += data;
+            } else if (senders[r] == 1) {
+                out->transmission_slots += data;
+                out->packet_count++;
+                out->ru_success[r]++;
+            } else {
+                out->collision_slots += data;
+                out->ru_collision[r]++;
+            }
+        }
+        out->triggers++;
+
+        for (k = 0; k < tx_count; k++) {
+            j = tx[k];
+            if (senders[pick[k]] > 1) {
+                if (nodes[j].cw_size < cfg->ocw_max) {
+                    nodes[j].cw_size = (nodes[j].cw_size * 2 < cfg->ocw_max) ?
+                                       nodes[j].cw_size * 2 : cfg->ocw_max;
+                }
+            } else if (cfg->policy == POLICY_RESET) {
+                nodes[j].cw_size = cfg->classes[sim_class_of(out, j)].cw_size;
+            }
+            nodes[j].backoff = rand_r(&out->seed) % nodes[j].cw_size;
+        }
+        i += len;
+
+        /* As in approx_run, the tallies run to the end of the cycle */
+        if (converge && next_check < i && i < end) {
+            if (sim_converged(out, i * ru)) {
+                out->slot = i;
+                return i;
+            }
+            while (next_check < i) {
+                next_check += CONVERGENCE_INTERVAL;
+            }
+        }
+    }
+
+    out->slot = end;
+    return end;
+}
+
+static inline void
+heap_move (heap_t *heap, int h, int j)
+{
+    heap->node[h] = j;
+    heap->pos[j] = h;
+}
+
+static void
+heap_up (heap_t *heap, int h)
+{
+    int j = heap->node[h], p;
+
+    while (h > 0 && heap->key[heap->node[p = (h - 1) / 2]] > heap->key[j]) {
+        heap_move(heap, h, heap->node[p]);
+        h = p;
+    }
+    heap_move(heap, h, j);
+}
+
+static void
+heap_down (heap_t *heap, int h)
+{
+    int j = heap->node[h], c;
+
+    while ((c = 2 * h + 1) < heap->count) {
+        if (c + 1 < heap->count &&
+            heap->key[heap->node[c + 1]] < heap->key[heap->node[c]]) {
+            c++;
+        }
+        if (heap->key[heap->node[c]] >= heap->key[j]) {
+            break;
+        }
+        heap_move(heap, h, heap->node[c]);
+        h = c;
+    }
+    heap_move(heap, h, j);
+}
+
+static void
+heap_push (heap_t *heap, int j)
+{
+    heap->node[heap->count] = j;
+    heap_up(heap, heap->count++);
+}
+
+static void
+heap_remove (heap_t *heap, int j)
+{
+    int h = heap->pos[j], last = heap->node[--heap->count];
+
+    heap->pos[j] = -1;
+    if (h < heap->count) {
+        heap_move(heap, h, last);
+        heap_up(heap, h);
+        heap_down(heap, heap->pos[last]);
+    }
+}
+
+/*
+ * Add the edge from j to k to the adjacency of a graph. The first pass over
+ * the edges, with no adjacency yet, only counts the degrees.
+ */
+static inline void
+topo_link (int *start, int *adj, int j, int k)
+{
+    if (adj == NULL) {
+        start[j]++;
+    } else {
+        adj[--start[j]] = k;
+    }
+}
+
+/*
+ * Turn the degrees of the n nodes in start into the offsets at which the
+ * adjacency of each one ends, and allocate the adjacency. Filling it in
+ * with topo_link moves every offset back to where the adjacency starts.
+ */
+static int *
+topo_index (arena_t *arena, int *start, int n)
+{
+    int j;
+
+    for (j = 1; j < n; j++) {
+        start[j] += start[j - 1];
+    }
+    start[n] = (n > 0) ? start[n - 1] : 0;
+
+    return arena_alloc(arena, (start[n] + 1) * sizeof(int));
+}
+
+static inline int
+topo_cell (double v, int side)
+{
+    int c = (int)floor(v);
+
+    return (c < 0) ? 0 : (c >= side) ? side - 1 : c;
+}
+
+/*
+ * Sort n points into the unit cells of a square of side cells. Returns the
+ * offsets of the cells in bin.
+ */
+static int *
+topo_bin (arena_t *arena, const double *x, const double *y, int n, int side,
+          int **bin)
+{
+    int cells = side * side, *start, j;
+
+    start = arena_alloc(arena, (cells + 1) * sizeof(int));
+    memset(start, 0, (cells + 1) * sizeof(int));
+    *bin = arena_alloc(arena, (n + 1) * sizeof(int));
+
+    for (j = 0; j < n; j++) {
+        start[topo_cell(y[j], side) * side + topo_cell(x[j], side)]++;
+    }
+    topo_index(arena, start, cells);
+    for (j = 0; j < n; j++) {
+        (*bin)[--start[topo_cell(y[j], side) * side +
+                       topo_cell(x[j], side)]] = j;
+    }
+
+    return start;
+}
+
+/*
+ * Lay out a geometric topology. Nodes and receivers are binned in unit
+ * cells, and ranges are at most 1, so only the cells around a node can
+ * hold the nodes that hear it and the receivers it reaches.
+ */
+static void
+topo_geometric (const config_t *cfg, arena_t *arena, unsigned int *seed,
+                topo_t *topo)
+{
+    int n = cfg->node_count, side = (int)ceil(cfg->area);
+    int *tx_start, *tx_bin, *rx_start, *rx_bin;
+    int pass, j, k, m, u, v, c;
+    double *x, *y, *rx, *ry, *range, angle, dx, dy;
+
+    x = arena_alloc(arena, n * sizeof(double));
+    y = arena_alloc(arena, n * sizeof(double));
+    rx = arena_alloc(arena, n * sizeof(double));
+    ry = arena_alloc(arena, n * sizeof(double));
+    range = arena_alloc(arena, n * sizeof(double));
+    for (j = 0; j < n; j++) {
+        x[j] = uniform(seed) * cfg->area;
+        y[j] = uniform(seed) * cfg->area;
+        range[j] = 1.0 - cfg->range_spread * uniform(seed);
+        angle = 2.0 * M_PI * uniform(seed);
+        rx[j] = x[j] + cfg->link_distance * range[j] * cos(angle);
+        ry[j] = y[j] + cfg->link_distance * range[j] * sin(angle);
+    }
+    tx_start = topo_bin(arena, x, y, n, side, &tx_bin);
+    rx_start = topo_bin(arena, rx, ry, n, side, &rx_bin);
+
+    topo->hear_start = arena_alloc(arena, (n + 1) * sizeof(int));
+    topo->reach_start = arena_alloc(arena, (n + 1) * sizeof(int));
+    memset(topo->hear_start, 0, (n + 1) * sizeof(int));
+    memset(topo->reach_start, 0, (n + 1) * sizeof(int));
+    topo->hear = topo->reach = NULL;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (j = 0; j < n; j++) {
+            for (v = topo_cell(y[j], side) - 1;
+                 v <= topo_cell(y[j], side) + 1; v++) {
+                for (u = topo_cell(x[j], side) - 1;
+                     u <= topo_cell(x[j], side) + 1; u++) {
+                    if (u < 0 || v < 0 || u >= side || v >= side) {
+                        continue;
+                    }
+                    c = v * side + u;
+                    for (m = tx_start[c]; m < tx_start[c + 1]; m++) {
+                        k = tx_bin[m];
+                        dx = x[k] - x[j];
+                        dy = y[k] - y[j];
+                        if (k != j &&
+                            dx * dx + dy * dy <= range[j] * range[j]) {
+                            topo_link(topo->hear_start, topo->hear, j, k);
+                        }
+                    }
+                    for (m = rx_start[c]; m < rx_start[c + 1]; m++) {
+                        k = rx_bin[m];
+                        dx = rx[k] - x[j];
+                        dy = ry[k] - y[j];
+                        if (k != j &&
+                            dx * dx + dy * dy <= range[j] * range[j]) {
+                            topo_link(topo->reach_start, topo->reach, j, k);
+                        }
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            topo->hear = topo_index(arena, topo->hear_start, n);
+            topo->reach = topo_index(arena, topo->reach_start, n);
+        }
+    }
+}
+
+/*
+ * Build a topology from the edges given link by link
+ */
+static void
+topo_links (const config_t *cfg, arena_t *arena, topo_t *topo)
+{
+    const topo_edge_t *e;
+    int n = cfg->node_count, pass, k;
+
+    topo->hear_start = arena_alloc(arena, (n + 1) * sizeof(int));
+    topo->reach_start = arena_alloc(arena, (n + 1) * sizeof(int));
+    memset(topo->hear_start, 0, (n + 1) * sizeof(int));
+    memset(topo->reach_start, 0, (n + 1) * sizeof(int));
+    topo->hear = topo->reach = NULL;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (k = 0; k < cfg->edge_count; k++) {
+            e = &cfg->edges[k];
+            if (e->kind == TOPO_HEAR) {
+                topo_link(topo->hear_start, topo->hear, e->from, e->to);
+            } else {
+                topo_link(topo->reach_start, topo->reach, e->from, e->to);
+            }
+        }
+        if (pass == 0) {
+            topo->hear = topo_index(arena, topo->hear_start, n);
+            topo->reach = topo_index(arena, topo->reach_start, n);
+        }
+    }
+}
+
+/*
+ * Count the links of a topology, and the sensing links that only go one
+ * way
+ */
+static void
+topo_count (const topo_t *topo, int n, sim_t *out)
+{
+    int j, k, m, r;
+
+    out->hear_links = topo->hear_start[n];
+    out->reach_links = topo->reach_start[n];
+    out->one_way = 0;
+    for (j = 0; j < n; j++) {
+        for (m = topo->hear_start[j]; m < topo->hear_start[j + 1]; m++) {
+            k = topo->hear[m];
+            for (r = topo->hear_start[k];
+                 r < topo->hear_start[k + 1] && topo->hear[r] != j; r++);
+            out->one_way += (r == topo->hear_start[k + 1]);
+        }
+    }
+}
+
+/*
+ * Simulate a run on a topology. Every node has a view of the channel of
+ * its own, so the run goes from event to event rather than slot by slot.
+ * A node counts its backoff down while it hears no transmission, and while
+ * it counts, it fires at a known slot. The counting nodes are kept in a
+ * heap by that slot. At every slot with events:
+ *
+ * 1. The transmissions that are over end. A success goes back to the
+ *    initial CW of its class under POLICY_RESET, and a loss doubles the
+ *    CW. The sender draws a new backoff. Nodes that no longer hear any
+ *    transmission resume counting, after sensing one idle slot if they
+ *    sensed a busy one, as in the shared engine.
+ * 2. The nodes that fire start transmitting. A frame is lost if a
+ *    transmission that reaches its receiver is under way or starts before
+ *    it is over. The nodes that hear it freeze their backoff. A frozen
+ *    node is exposed if it could have sent without harm: no transmission
+ *    reaches its receiver, and its own reaches none of the receivers in
+ *    use.
+ *
+ * Efficiency counts the slots of every successful transmission, so with
+ * spatial reuse it may exceed 1.
+ */
+static int
+topo_run (const config_t *cfg, arena_t *arena, sim_t *out, int end,
+          int converge)
+{
+    topo_t topo;
+    heap_t heap;
+    node_t *nodes;
+    int n = cfg->node_count, len = cfg->pkt_size, stop = end;
+    int *fire, *busy, *since, *jam, *start, *lost, *ring, *delivered, *fired;
+    int head = 0, tail = 0, active = 0, quiet = 0, fired_count;
+    int next_check = CONVERGENCE_INTERVAL, c, f, i, j, k, m, r;
+    double sum = 0.0, sq = 0.0;
+
+    memset(out, 0, sizeof(*out));
+    out->cfg = cfg;
+    out->seed = cfg->seed;
+    out->prev_efficiency = 0.000001;
+    out->prev_delta = 1.0;
+    out->node_count = n;
+    out->nodes = nodes = arena_alloc(arena, n * sizeof(node_t));
+    fire = arena_alloc(arena, n * sizeof(int));
+    busy = arena_alloc(arena, n * sizeof(int));
+    since = arena_alloc(arena, n * sizeof(int));
+    jam = arena_alloc(arena, n * sizeof(int));
+    start = arena_alloc(arena, n * sizeof(int));
+    lost = arena_alloc(arena, n * sizeof(int));
+    ring = arena_alloc(arena, n * sizeof(int));
+    delivered = arena_alloc(arena, n * sizeof(int));
+    fired = arena_alloc(arena, n * sizeof(int));
+    heap.node = arena_alloc(arena, n * sizeof(int));
+    heap.pos = arena_alloc(arena, n * sizeof(int));
+    heap.key = fire;
+    heap.count = 0;
+    memset(busy, 0, n * sizeof(int));
+    memset(jam, 0, n * sizeof(int));
+    memset(delivered, 0, n * sizeof(int));
+
+    if (cfg->topology == TOPO_GEOMETRIC) {
+        topo_geometric(cfg, arena, &out->seed, &topo);
+    } else {
+        topo_links(cfg, arena, &topo);
+    }
+    topo_count(&topo, n, out);
+
+    for (c = 0, j = 0; c < cfg->class_count; c++) {
+        for (k = 0; k < cfg->classes[c].count; k++, j++) {
+            nodes[j].cw_size = cfg->classes[c].cw_size;
+            nodes[j].backoff = rand_r(&out->seed) % nodes[j].cw_size + 1;
+            fire[j] = nodes[j].backoff - 1;
+            start[j] = -1;
+            heap.pos[j] = -1;
+            heap_push(&heap, j);
+        }
+        out->class_end[c] = j;
+    }
+
+    for (;;) {
+        i = end;
+        if (heap.count > 0 && fire[heap.node[0]] < i) {
+            i = fire[heap.node[0]];
+        }
+        if (active > 0 && start[ring[head]] + len < i) {
+            i = start[ring[head]] + len;
+        }
+        while (converge && next_check <= i && next_check < end) {
+            if (sim_converged(out, next_check)) {
+                stop = next_check;
+                break;
+            }
+            next_check += CONVERGENCE_INTERVAL;
+        }
+        if (stop < end || i == end) {
+            break;
+        }
+
+        /* Transmissions that are over */
+        while (active > 0 && start[ring[head]] + len == i) {
+            j = ring[head];
+            head = (head + 1) % n;
+            if (--active == 0) {
+                quiet = i;
+            }
+            for (m = topo.reach_start[j]; m < topo.reach_start[j + 1]; m++) {
+                jam[topo.reach[m]]--;
+            }
+            for (m = topo.hear_start[j]; m < topo.hear_start[j + 1]; m++) {
+                k = topo.hear[m];
+                if (--busy[k] == 0 && start[k] < 0) {
+                    fire[k] = ((i > since[k] + 1) ? i + 1 : i) +
+                              nodes[k].backoff - 1;
+                    heap_push(&heap, k);
+                }
+            }
+
+            if (lost[j]) {
+                out->collision_slots += len;
+                if (nodes[j].cw_size < MAX_BACKOFF_CW) {
+                    nodes[j].cw_size *= 2;
+                }
+            } else {
+                out->transmission_slots += len;
+                out->packet_count++;
+                delivered[j]++;
+                if (cfg->policy == POLICY_RESET) {
+                    nodes[j].cw_size =
+                        cfg->classes[sim_class_of(out, j)].cw_size;
+                }
+            }
+            start[j] = -1;
+            since[j] = i - len;
+            nodes[j].backoff = rand_r(&out->seed) % nodes[j].cw_size + 1;
+            if (busy[j] == 0) {
+                fire[j] = ((len > 1) ? i + 1 : i) + nodes[j].backoff - 1;
+                heap_push(&heap, j);
+            }
+        }
+
+        /* Nodes that fire */
+        fired_count = 0;
+        while (heap.count > 0 && fire[heap.node[0]] == i) {
+            j = heap.node[0];
+            heap_remove(&heap, j);
+            fired[fired_count++] = j;
+            start[j] = i;
+            lost[j] = (jam[j] > 0);
+            ring[tail] = j;
+            tail = (tail + 1) % n;
+            if (active++ == 0) {
+                out->idle_slots += i - quiet;
+            }
+        }
+        for (f = 0; f < fired_count; f++) {
+            j = fired[f];
+            for (m = topo.reach_start[j]; m < topo.reach_start[j + 1]; m++) {
+                k = topo.reach[m];
+                jam[k]++;
+                if (start[k] >= 0) {
+                    lost[k] = 1;
+                }
+            }
+        }
+        for (f = 0; f < fired_count; f++) {
+            j = fired[f];
+            for (m = topo.hear_start[j]; m < topo.hear_start[j + 1]; m++) {
+                k = topo.hear[m];
+                if (busy[k]++ > 0 || start[k] >= 0) {
+                    continue;
+                }
+                nodes[k].backoff = fire[k] - i;
+                heap_remove(&heap, k);
+                since[k] = i;
+                out->deferrals++;
+                if (jam[k] > 0) {
+                    continue;
+                }
+                for (r = topo.reach_start[k];
+                     r < topo.reach_start[k + 1] &&
+                     start[topo.reach[r]] < 0; r++);
+                out->exposed += (r == topo.reach_start[k + 1]);
+            }
+        }
+    }
+
+    if (active == 0) {
+        out->idle_slots += stop - quiet;
+    }
+    for (j = 0; j < n; j++) {
+        sum += delivered[j];
+        sq += (double)delivered[j] * delivered[j];
+    }
+    out->fairness = (sq > 0.0) ? sum * sum / (n * sq) : 0.0;
+
+    out->slot = stop;
+    return stop;
+}
+
+/*
+ * Slot of chain state in the hash table to start looking from
+ */
+static unsigned int
+markov_hash (const markov_t *mk, const uint16_t *state)
+{
+    uint32_t hash = 2166136261u;
+    int j;
+
+    for (j = 0; j < mk->nodes; j++) {
+        hash = (hash ^ state[j]) * 16777619u;
+    }
+    return hash & mk->table_mask;
+}
+
+/*
+ * Double the room for chain states, or to start with MARKOV_ROOM, and
+ * rehash them into a table twice as big. Returns -1 if the chain would
+ * have more than MAX_MARKOV_STATES states.
+ */
+static int
+markov_grow (markov_t *mk)
+{
+    int room = mk->state_room ? 2 * mk->state_room : MARKOV_ROOM;
+    uint16_t *states;
+    double *quiet, *single;
+    int *row_start, x;
+    unsigned int h;
+
+    if (mk->state_room == MAX_MARKOV_STATES) {
+        return -1;
+    }
+    room = (room < MAX_MARKOV_STATES) ? room : MAX_MARKOV_STATES;
+
+    states = arena_alloc(mk->arena,
+                         (size_t)room * mk->nodes * sizeof(uint16_t));
+    quiet = arena_alloc(mk->arena, room * sizeof(double));
+    single = arena_alloc(mk->arena, room * sizeof(double));
+    row_start = arena_alloc(mk->arena, (room + 1) * sizeof(int));
+    if (mk->state_count > 0) {
+        memcpy(states, mk->states,
+               (size_t)mk->state_count * mk->nodes * sizeof(uint16_t));
+        memcpy(quiet, mk->quiet, mk->state_count * sizeof(double));
+        memcpy(single, mk->single, mk->state_count * sizeof(double));
+        memcpy(row_start, mk->row_start, mk->state_count * sizeof(int));
+    }
+    mk->states = states;
+    mk->quiet = quiet;
+    mk->single = single;
+    mk->row_start = row_start;
+    mk->state_room = room;
+
+    mk->table_mask = 2 * room - 1;
+    mk->table = arena_alloc(mk->arena, 2 * room * sizeof(int));
+    memset(mk->table, 0xff, 2 * room * sizeof(int));
+    for (x = 0; x < mk->state_count; x++) {
+        for (h = markov_hash(mk, &mk->states[(size_t)x * mk->nodes]);
+             mk->table[h] >= 0; h = (h + 1) & mk->table_mask);
+        mk->table[h] = x;
+    }
+    return 0;
+}
+
+/*
+ * Index of chain state, adding it if it is new. Returns -1 if there's no
+ * room for it.
+ */
+static int
+markov_find (markov_t *mk, const uint16_t *state)
+{
+    unsigned int h;
+    int x;
+
+    for (h = markov_hash(mk, state); (x = mk->table[h]) >= 0;
+         h = (h + 1) & mk->table_mask) {
+        if (memcmp(&mk->states[(size_t)x * mk->nodes], state,
+                   mk->nodes * sizeof(uint16_t)) == 0) {
+            return x;
+        }
+    }
+
+    if (mk->state_count == mk->state_room) {
+        if (markov_grow(mk) < 0) {
+            return -1;
+        }
+        for (h = markov_hash(mk, state); mk->table[h] >= 0;
+             h = (h + 1) & mk->table_mask);
+    }
+    x = mk->state_count++;
+    memcpy(&mk->states[(size_t)x * mk->nodes], state,
+           mk->nodes * sizeof(uint16_t));
+    mk->table[h] = x;
+    return x;
+}
+
+/*
+ * Work out the transitions out of chain state x, over one slot in which
+ * the counters move. A node whose counter range is r sends with
+ * probability 1 / r, and otherwise narrows its range to r - 1. The nodes
+ * in the same state send independently, so the number of them that send
+ * is binomial, and the outcomes are gone through as one such number per
+ * occupied state. The senders move to their next stage, with the full
+ * range of its CW. Returns -1 if the chain gets too big.
+ */
+static int
+markov_expand (markov_t *mk, int x)
+{
+    static const double choose[MAX_MARKOV_NODES + 1][MAX_MARKOV_NODES + 1] = {
+        { 1 }, { 1, 1 }, { 1, 2, 1 }, { 1, 3, 3, 1 }, { 1, 4, 6, 4, 1 },
+        { 1, 5, 10, 10, 5, 1 }, { 1, 6, 15, 20, 15, 6, 1 },
+        { 1, 7, 21, 35, 35, 21, 7, 1 }, { 1, 8, 28, 56, 70, 56, 28, 8, 1 }
+    };
+    const config_t *cfg = mk->cfg;
+    uint16_t st[MAX_MARKOV_NODES], next[MAX_MARKOV_NODES], v;
+    int first[MAX_MARKOV_NODES], count[MAX_MARKOV_NODES];
+    int sent[MAX_MARKOV_NODES];
+    int n = mk->nodes, groups = 0, k, g, j, s, u, o, y, room;
+    double odds[MAX_MARKOV_NODES][MAX_MARKOV_NODES + 1];
+    double p, q, *prob;
+    int *target;
+
+    /* The states move when markov_find makes room for more */
+    memcpy(st, &mk->states[(size_t)x * n], n * sizeof(uint16_t));
+
+    /* odds[g][k] is the chance that k of the nodes of group g send */
+    for (j = 0; j < n; j = u) {
+        for (u = j; u < n && st[u] == st[j]; u++);
+        first[groups] = j;
+        count[groups] = u - j;
+        sent[groups] = 0;
+        q = 1.0 / mk->range_of[st[j]];
+        for (k = 0; k <= u - j; k++) {
+            odds[groups][k] = choose[u - j][k] * pow(q, k) *
+                              pow(1.0 - q, u - j - k);
+        }
+        groups++;
+    }
+
+    mk->row_start[x] = mk->transition_count;
+    mk->quiet[x] = mk->single[x] = 0.0;
+
+    for (;;) {
+        p = 1.0;
+        for (k = 0, g = 0; g < groups; g++) {
+            p *= odds[g][sent[g]];
+            k += sent[g];
+        }
+
+        if (p > 0.0) {
+            for (o = 0, g = 0; g < groups; g++) {
+                s = mk->stage_of[st[first[g]]];
+                if (k > 1) {
+                    s = (s < cfg->max_stage) ? s + 1 : s;
+                } else if (cfg->policy == POLICY_RESET) {
+                    s = 0;
+                }
+                for (j = 0; j < count[g]; j++, o++) {
+                    v = (j < sent[g]) ? mk->first[s + 1] - 1 :
+                                        st[first[g]] - 1;
+                    for (u = o; u > 0 && next[u - 1] > v; u--) {
+                        next[u] = next[u - 1];
+                    }
+                    next[u] = v;
+                }
+            }
+
+            if (mk->transition_count == mk->transition_room) {
+                if (mk->transition_room == MAX_MARKOV_TRANSITIONS) {
+                    return -1;
+                }
+                room = 2 * mk->transition_room;
+                room = (room < MAX_MARKOV_TRANSITIONS) ?
+                       room : MAX_MARKOV_TRANSITIONS;
+                target = arena_alloc(mk->arena, room * sizeof(int));
+                prob = arena_alloc(mk->arena, room * sizeof(double));
+                memcpy(target, mk->target,
+                       mk->transition_count * sizeof(int));
+                memcpy(prob, mk->prob, mk->transition_count * sizeof(double));
+                mk->target = target;
+                mk->prob = prob;
+                mk->transition_room = room;
+            }
+            if ((y = markov_find(mk, next)) < 0) {
+                return -1;
+            }
+            mk->target[mk->transition_count] = y;
+            mk->prob[mk->transition_count++] = p;
+            if (k == 0) {
+                mk->quiet[x] += p;
+            } else if (k == 1) {
+                mk->single[x] += p;
+            }
+        }
+
+        for (g = groups - 1; g >= 0 && sent[g] == count[g]; g--) {
+            sent[g] = 0;
+        }
+        if (g < 0) {
+            break;
+        }
+        sent[g]++;
+    }
+    return 0;
+}
+
+/*
+ * Solve the Markov chain of the saturated nodes of cfg for its stationary
+ * distribution, and report the share of idle, transmission and collision
+ * slots it gives as counts over the slot horizon. The chain is explored
+ * breadth first from the state with every node at the full range of the
+ * first stage, and solved by Gauss-Seidel sweeps over the transitions into
+ * each state, in the order the states were found. Most transitions only
+ * count a node down, into a state found later, so a sweep carries the
+ * probability along them in one go, where power iteration takes a step.
+ *
+ * A step of the chain in which nobody sends takes one idle slot. One in
+ * which someone does takes pkt_size slots, then the idle slot in which
+ * every node senses the channel free again, as in the shared engine. The
+ * share of slots of each kind is that of the expected slots of each kind
+ * per step. Returns -1 if the chain is too big to solve.
+ */
+static int
+markov_run (const config_t *cfg, arena_t *arena, sim_t *out)
+{
+    markov_t mk;
+    uint16_t start[MAX_MARKOV_NODES];
+    double *pi, *prev, *in_prob, *self;
+    double cycle = 0.0, tx = 0.0, coll = 0.0, succ = 0.0, sum, diff;
+    int *in_start, *source;
+    int counters, busy, x, e, it, s, r, j, y;
+
+    memset(out, 0, sizeof(*out));
+    out->cfg = cfg;
+    out->node_count = cfg->node_count;
+    out->class_end[0] = cfg->node_count;
+
+    memset(&mk, 0, sizeof(mk));
+    mk.cfg = cfg;
+    mk.arena = arena;
+    mk.nodes = cfg->node_count;
+    for (s = 0; s <= cfg->max_stage + 1; s++) {
+        mk.first[s] = cfg->cw_size * ((1 << s) - 1);
+    }
+    counters = mk.first[cfg->max_stage + 1];
+    mk.stage_of = arena_alloc(arena, counters * sizeof(int));
+    mk.range_of = arena_alloc(arena, counters * sizeof(int));
+    for (s = 0; s <= cfg->max_stage; s++) {
+        for (r = 1; r <= cfg->cw_size << s; r++) {
+            mk.stage_of[mk.first[s] + r - 1] = s;
+            mk.range_of[mk.first[s] + r - 1] = r;
+        }
+    }
+
+    markov_grow(&mk);
+    mk.transition_room = MARKOV_ROOM;
+    mk.target = arena_alloc(arena, MARKOV_ROOM * sizeof(int));
+    mk.prob = arena_alloc(arena, MARKOV_ROOM * sizeof(double));
+
+    for (j = 0; j < mk.nodes; j++) {
+        start[j] = mk.first[1] - 1;
+    }
+    markov_find(&mk, start);
+    for (x = 0; x < mk.state_count; x++) {
+        if (markov_expand(&mk, x) < 0) {
+            out->markov_states = mk.state_count;
+            out->markov_transitions = mk.transition_count;
+            return -1;
+        }
+    }
+    mk.row_start[mk.state_count] = mk.transition_count;
+
+    /*
+     * Start from the states that recur. The last transition of a state is
+     * the one in which every node sends, and max_stage + 1 of them in a row
+     * lead to a state reached from anywhere. The states reached from it in
+     * turn are those that recur; under POLICY_DOUBLE, the others are left
+     * behind for good, and sweeping them out would take most of the time.
+     * The queue of the search is kept where the sources of the
+     * transitions into each state go afterwards.
+     */
+    source = arena_alloc(arena, mk.transition_count * sizeof(int));
+    pi = arena_alloc(arena, mk.state_count * sizeof(double));
+    prev = arena_alloc(arena, mk.state_count * sizeof(double));
+    memset(pi, 0, mk.state_count * sizeof(double));
+    for (x = 0, s = 0; s <= cfg->max_stage; s++) {
+        x = mk.target[mk.row_start[x + 1] - 1];
+    }
+    source[0] = x;
+    pi[x] = 1.0;
+    for (j = 1, r = 0; r < j; r++) {
+        x = source[r];
+        for (e = mk.row_start[x]; e < mk.row_start[x + 1]; e++) {
+            if (pi[mk.target[e]] == 0.0) {
+                pi[mk.target[e]] = 1.0;
+                source[j++] = mk.target[e];
+            }
+        }
+    }
+    for (x = 0; x < mk.state_count; x++) {
+        pi[x] /= j;
+    }
+
+    /* Turn the rows around, keeping the chance of staying put apart */
+    in_start = arena_alloc(arena, (mk.state_count + 1) * sizeof(int));
+    in_prob = arena_alloc(arena, mk.transition_count * sizeof(double));
+    self = arena_alloc(arena, mk.state_count * sizeof(double));
+    memset(in_start, 0, (mk.state_count + 1) * sizeof(int));
+    memset(self, 0, mk.state_count * sizeof(double));
+    for (x = 0; x < mk.state_count; x++) {
+        for (e = mk.row_start[x]; e < mk.row_start[x + 1]; e++) {
+            in_start[mk.target[e] + 1] += (mk.target[e] != x);
+        }
+    }
+    for (x = 0; x < mk.state_count; x++) {
+        in_start[x + 1] += in_start[x];
+    }
+    for (x = 0; x < mk.state_count; x++) {
+        for (e = mk.row_start[x]; e < mk.row_start[x + 1]; e++) {
+            y = mk.target[e];
+            if (y == x) {
+                self[x] += mk.prob[e];
+                continue;
+            }
+            source[in_start[y]] = x;
+            in_prob[in_start[y]++] = mk.prob[e];
+        }
+    }
+    for (x = mk.state_count; x > 0; x--) {
+        in_start[x] = in_start[x - 1];
+    }
+    in_start[0] = 0;
+
+    for (it = 1; it <= MARKOV_MAX_ITERATIONS; it++) {
+        memcpy(prev, pi, mk.state_count * sizeof(double));
+        for (sum = 0.0, x = 0; x < mk.state_count; x++) {
+            pi[x] = 0.0;
+            for (e = in_start[x]; e < in_start[x + 1]; e++) {
+                pi[x] += pi[source[e]] * in_prob[e];
+            }
+            pi[x] = (self[x] < 1.0) ? pi[x] / (1.0 - self[x]) : prev[x];
+            sum += pi[x];
+        }
+        for (diff = 0.0, x = 0; x < mk.state_count; x++) {
+            pi[x] /= sum;
+            diff += fabs(pi[x] - prev[x]);
+        }
+        if (diff < MARKOV_TOLERANCE) {
+            break;
+        }
+    }
+
+    busy = cfg->pkt_size + (cfg->pkt_size > 1);
+    for (x = 0; x < mk.state_count; x++) {
+        cycle += pi[x] * (mk.quiet[x] + (1.0 - mk.quiet[x]) * busy);
+        tx += pi[x] * mk.single[x] * cfg->pkt_size;
+        coll += pi[x] * (1.0 - mk.quiet[x] - mk.single[x]) * cfg->pkt_size;
+        succ += pi[x] * mk.single[x];
+    }
+
+    out->markov_states = mk.state_count;
+    out->markov_transitions = mk.transition_count;
+    out->markov_iterations = (it > MARKOV_MAX_ITERATIONS) ?
+                             MARKOV_MAX_ITERATIONS : it;
+    out->model_efficiency = tx / cycle;
+    out->model_throughput = succ / cycle;
+    out->transmission_slots = (int)llround(tx / cycle * cfg->slot_size);
+    out->collision_slots = (int)llround(coll / cycle * cfg->slot_size);
+    out->idle_slots = cfg->slot_size - out->transmission_slots -
+                      out->collision_slots;
+    out->packet_count = (int)llround(succ / cycle * cfg->slot_size);
+    out->slot = cfg->slot_size;
+    return cfg->slot_size;
+}
+
+/*
+ * Iterate the mean-field dynamics of the saturated nodes of cfg over the
+ * slot horizon, and report the share of idle, transmission and collision
+ * slots they give as counts. This follows the rules of the shared engine,
+ * including the CW doubling up to MAX_BACKOFF_CW, for any number of nodes
+ * in the same time.
+ *
+ * A step is a slot in which the counters move. A fraction of the nodes
+ * that enter stage s in some step, with a counter uniform in [1, W], sends
+ * in each of the next W steps in equal parts, as in the Markov chain. So
+ * the fraction of a class that sends from stage s is the sum of what
+ * entered it over the last W steps, over W. A sender succeeds if none of
+ * the others sends, which each of them does independently at the rate of
+ * its class. The step then takes as many slots as in the Markov chain.
+ * Only the stages up to the highest one reached so far are gone through.
+ */
+static int
+meanfield_run (const config_t *cfg, arena_t *arena, sim_t *out)
+{
+    double *ring[MAX_NODE_CLASSES][MAX_BACKOFF_STAGE];
+    double window[MAX_NODE_CLASSES][MAX_BACKOFF_STAGE];
+    double sent[MAX_NODE_CLASSES][MAX_BACKOFF_STAGE];
+    double entered[MAX_NODE_CLASSES][MAX_BACKOFF_STAGE];
+    long cw[MAX_NODE_CLASSES][MAX_BACKOFF_STAGE];
+    long pos[MAX_NODE_CLASSES][MAX_BACKOFF_STAGE];
+    int stages[MAX_NODE_CLASSES], top[MAX_NODE_CLASSES];
+    double tau[MAX_NODE_CLASSES], quiet[MAX_NODE_CLASSES];
+    double idle, single, slots = 0.0, tx = 0.0, coll = 0.0, succ = 0.0;
+    double drift;
+    long step;
+    int busy = cfg->pkt_size + (cfg->pkt_size > 1), c, d, s, next;
+
+    memset(out, 0, sizeof(*out));
+    out->cfg = cfg;
+    out->node_count = cfg->node_count;
+
+    memset(ring, 0, sizeof(ring));
+    memset(window, 0, sizeof(window));
+    memset(pos, 0, sizeof(pos));
+    memset(out->stage_share, 0, sizeof(out->stage_share));
+    for (c = 0; c < cfg->class_count; c++) {
+        out->class_end[c] = (c ? out->class_end[c - 1] : 0) +
+                            cfg->classes[c].count;
+        cw[c][0] = cfg->classes[c].cw_size;
+        for (s = 0; cw[c][s] < MAX_BACKOFF_CW; s++) {
+            cw[c][s + 1] = 2 * cw[c][s];
+        }
+        stages[c] = s + 1;
+        top[c] = 0;
+        for (s = 0; s < stages[c]; s++) {
+            if (cw[c][s] <= cfg->slot_size) {
+                ring[c][s] = arena_alloc(arena, cw[c][s] * sizeof(double));
+                memset(ring[c][s], 0, cw[c][s] * sizeof(double));
+            }
+        }
+
+        /* Every node starts at the first stage */
+        if (ring[c][0] != NULL) {
+            ring[c][0][0] = 1.0;
+        }
+        window[c][0] = out->stage_share[c][0] = 1.0;
+    }
+
+    for (step = 1; slots < cfg->slot_size; step++) {
+        for (c = 0; c < cfg->class_count; c++) {
+            tau[c] = 0.0;
+            for (s = 0; s <= top[c]; s++) {
+                sent[c][s] = window[c][s] / cw[c][s];
+                entered[c][s] = 0.0;
+                tau[c] += sent[c][s];
+            }
+            if (top[c] + 1 < stages[c]) {
+                entered[c][top[c] + 1] = 0.0;
+            }
+        }
+
+        idle = 1.0;
+        single = 0.0;
+        for (c = 0; c < cfg->class_count; c++) {
+            idle *= pow(1.0 - tau[c], cfg->classes[c].count);
+            quiet[c] = 1.0;
+            for (d = 0; d < cfg->class_count; d++) {
+                quiet[c] *= pow(1.0 - tau[d],
+                                cfg->classes[d].count - (c == d));
+            }
+            single += cfg->classes[c].count * tau[c] * quiet[c];
+        }
+
+        /*
+         * The senders redraw their counters, from the first stage after a
+         * success under POLICY_RESET, and from the next stage after a
+         * collision
+         */
+        out->meanfield_drift = 0.0;
+        for (c = 0; c < cfg->class_count; c++) {
+            for (s = 0; s <= top[c]; s++) {
+                next = (cfg->policy == POLICY_RESET) ? 0 : s;
+                entered[c][next] += sent[c][s] * quiet[c];
+                next = (s + 1 < stages[c]) ? s + 1 : s;
+                entered[c][next] += sent[c][s] * (1.0 - quiet[c]);
+            }
+            if (top[c] + 1 < stages[c] && entered[c][top[c] + 1] > 0.0) {
+                top[c]++;
+            }
+            drift = 0.0;
+            for (s = 0; s <= top[c]; s++) {
+                if (ring[c][s] != NULL) {
+                    if (++pos[c][s] == cw[c][s]) {
+                        pos[c][s] = 0;
+                    }
+                    window[c][s] -= ring[c][s][pos[c][s]];
+                    ring[c][s][pos[c][s]] = entered[c][s];
+                }
+                window[c][s] += entered[c][s];
+                if (window[c][s] < 0.0) {
+                    window[c][s] = 0.0;
+                }
+                out->stage_share[c][s] += entered[c][s] - sent[c][s];
+                drift += fabs(entered[c][s] - sent[c][s]);
+            }
+            out->meanfield_drift = fmax(out->meanfield_drift, drift);
+        }
+
+        slots += idle + (1.0 - idle) * busy;
+        tx += single * cfg->pkt_size;
+        coll += (1.0 - idle - single) * cfg->pkt_size;
+        succ += single;
+        out->meanfield_final = single * cfg->pkt_size /
+                               (idle + (1.0 - idle) * busy);
+    }
+
+    for (c = 0; c < cfg->class_count; c++) {
+        out->meanfield_stages = (stages[c] > out->meanfield_stages) ?
+                                stages[c] : out->meanfield_stages;
+    }
+    out->meanfield_steps = step - 1;
+    out->model_efficiency = tx / slots;
+    out->model_throughput = succ / slots;
+    out->transmission_slots = (int)llround(tx / slots * cfg->slot_size);
+    out->collision_slots = (int)llround(coll / slots * cfg->slot_size);
+    out->idle_slots = cfg->slot_size - out->transmission_slots -
+                      out->collision_slots;
+    out->packet_count = (int)llround(succ / slots * cfg->slot_size);
+    out->slot = cfg->slot_size;
+    return cfg->slot_size;
+}
+
+/*
+ * Draw a backoff from [1, w] for a node other than node 0, whose counter
+ * is target. Under the tilt, the draw is target with probability tilt / w,
+ * up to RARE_MAX_AIM, and uniform otherwise, so that hitting node 0 is
+ * about tilt times likelier. lr takes the likelihood ratio of the draw.
+ * Aiming each draw only a little keeps the ratio of the draws that miss
+ * close to 1.
+ */
+static int
+rare_draw (unsigned int *seed, int w, int target, double tilt, double *lr)
+{
+    double aim = fmin(tilt / w, RARE_MAX_AIM);
+    int b;
+
+    if (tilt <= 1.0 || target > w) {
+        return rand_r(seed) % w + 1;
+    }
+
+    b = (uniform(seed) < aim) ? target : rand_r(seed) % w + 1;
+    *lr /= (1.0 - aim) + ((b == target) ? aim * w : 0.0);
+    return b;
+}
+
+/*
+ * Follow the packet of node 0 that starts at the state of nodes, under the
+ * tilt, until it goes through or both of its rare events are settled. A
+ * packet is dropped when its retry_limit-th collision ends, and starved
+ * when the transmission that goes through hasn't started within
+ * starve_slots slots. Each event adds the likelihood ratio of the draws
+ * that led to it.
+ */
+static void
+rare_clone (sim_t *sim, const node_t *start, node_t *nodes,
+            unsigned int *seed)
+{
+    const config_t *cfg = sim->cfg;
+    rare_t *rare = &sim->rare;
+    int n = cfg->node_count, len = cfg->pkt_size;
+    int dropped = (cfg->retry_limit == 0), starved = (cfg->starve_slots == 0);
+    int tries = 0, senders, m, j;
+    long elapsed = 0;
+    double lr = 1.0;
+
+    memcpy(nodes, start, n * sizeof(node_t));
+    rare->samples++;
+
+    for (;;) {
+        for (m = nodes[0].backoff, j = 1; j < n; j++) {
+            m = (nodes[j].backoff < m) ? nodes[j].backoff : m;
+        }
+        if (!starved && elapsed + m - 1 >= cfg->starve_slots) {
+            starved = 1;
+            rare->starve_sum += lr;
+            rare->starve_sq += lr * lr;
+            if (dropped) {
+                return;
+            }
+        }
+
+        for (senders = 0, j = 0; j < n; j++) {
+            nodes[j].backoff -= m;
+            senders += (nodes[j].backoff == 0);
+        }
+        if (nodes[0].backoff == 0 && senders == 1) {
+            return;
+        }
+        elapsed += m - 1 + len + (len > 1);
+
+        /* Node 0 redraws first, so that the others can aim at it */
+        if (nodes[0].backoff == 0) {
+            if (nodes[0].cw_size < MAX_BACKOFF_CW) {
+                nodes[0].cw_size *= 2;
+            }
+            nodes[0].backoff = rand_r(seed) % nodes[0].cw_size + 1;
+            if (!dropped && ++tries == cfg->retry_limit) {
+                dropped = 1;
+                rare->drop_sum += lr;
+                rare->drop_sq += lr * lr;
+                if (starved) {
+                    return;
+                }
+            }
+        }
+        for (j = 1; j < n; j++) {
+            if (nodes[j].backoff > 0) {
+                continue;
+            }
+            if (senders > 1) {
+                if (nodes[j].cw_size < MAX_BACKOFF_CW) {
+                    nodes[j].cw_size *= 2;
+                }
+            } else if (cfg->policy == POLICY_RESET) {
+                nodes[j].cw_size = cfg->classes[sim_class_of(sim, j)].cw_size;
+            }
+            nodes[j].backoff = rare_draw(seed, nodes[j].cw_size,
+                                         nodes[0].backoff, cfg->tilt, &lr);
+        }
+    }
+}
+
+/*
+ * Save node j to the undo log of the copy, unless it already has been
+ */
+static inline void
+split_save (split_t *sp, int j)
+{
+    if (sp->saved[j] == sp->copy) {
+        return;
+    }
+    sp->log_node[sp->log_count] = j;
+    sp->log_saved[sp->log_count] = sp->saved[j];
+    sp->log_key[sp->log_count] = sp->key[j];
+    sp->log_cw[sp->log_count++] = sp->cw_size[j];
+    sp->saved[j] = sp->copy;
+}
+
+/*
+ * Undo the changes to the nodes logged after mark
+ */
+static void
+split_rollback (split_t *sp, int mark)
+{
+    int j;
+
+    while (sp->log_count > mark) {
+        j = sp->log_node[--sp->log_count];
+        sp->saved[j] = sp->log_saved[sp->log_count];
+        sp->key[j] = sp->log_key[sp->log_count];
+        sp->cw_size[j] = sp->log_cw[sp->log_count];
+    }
+}
+
+static void split_path(sim_t *sim, split_t *sp, long base, long elapsed,
+                       int tries, int dropped, int starved, int level,
+                       double weight);
+
+/*
+ * Continue a copy of the clone as split copies, which share its weight
+ */
+static void
+split_fork (sim_t *sim, split_t *sp, long base, long elapsed, int tries,
+            int dropped, int starved, int level, double weight)
+{
+    int mark = sp->log_count, k;
+
+    for (k = 0; k < sim->cfg->split; k++) {
+        split_rollback(sp, mark);
+        sp->copy = ++sp->copies;
+        sp->paths++;
+        split_path(sim, sp, base, elapsed, tries, dropped, starved, level,
+                   weight / sim->cfg->split);
+    }
+    split_rollback(sp, mark);
+}
+
+/*
+ * Follow a copy of the clone from step base, elapsed slots into the packet
+ * of node 0, until the packet goes through or both of its rare events are
+ * settled, as in rare_clone. The senders of step base, if any, haven't
+ * redrawn yet. Each event adds the weight of the copy. level is the next
+ * starvation level the copy can be split at.
+ */
+static void
+split_path (sim_t *sim, split_t *sp, long base, long elapsed, int tries,
+            int dropped, int starved, int level, double weight)
+{
+    const config_t *cfg = sim->cfg;
+    int n = cfg->node_count, len = cfg->pkt_size, senders, j;
+    long next;
+
+    for (;;) {
+        for (senders = 0, j = 0; j < n; j++) {
+            senders += (sp->key[j] == base);
+        }
+        for (j = 0; j < n && senders > 0; j++) {
+            if (sp->key[j] != base) {
+                continue;
+            }
+            split_save(sp, j);
+            if (senders > 1) {
+                if (sp->cw_size[j] < MAX_BACKOFF_CW) {
+                    sp->cw_size[j] *= 2;
+                }
+            } else if (cfg->policy == POLICY_RESET) {
+                sp->cw_size[j] = cfg->classes[sim_class_of(sim, j)].cw_size;
+            }
+            sp->key[j] = base + rand_r(&sp->seed) % sp->cw_size[j] + 1;
+        }
+
+        for (next = sp->key[0], j = 1; j < n; j++) {
+            next = (sp->key[j] < next) ? sp->key[j] : next;
+        }
+        if (!starved && elapsed + next - base - 1 >= cfg->starve_slots) {
+            starved = 1;
+            sp->starve += weight;
+            if (dropped) {
+                return;
+            }
+        }
+        while (!starved && level < SPLIT_STARVE_LEVELS &&
+               elapsed + next - base - 1 >=
+               (long)cfg->starve_slots * level / SPLIT_STARVE_LEVELS) {
+            if (sp->paths < SPLIT_MAX_PATHS) {
+                split_fork(sim, sp, base, elapsed, tries, dropped, starved,
+                           level + 1, weight);
+                return;
+            }
+            level++;
+        }
+
+        elapsed += next - base - 1;
+        base = next;
+        for (senders = 0, j = 0; j < n; j++) {
+            senders += (sp->key[j] == base);
+        }
+        if (sp->key[0] == base && senders == 1) {
+            return;
+        }
+        elapsed += len + (len > 1);
+
+        if (sp->key[0] == base && !dropped) {
+            if (++tries == cfg->retry_limit) {
+                dropped = 1;
+                sp->drop += weight;
+                if (starved) {
+                    return;
+                }
+            } else if (sp->paths < SPLIT_MAX_PATHS) {
+                split_fork(sim, sp, base, elapsed, tries, dropped, starved,
+                           level, weight);
+                return;
+            }
+        }
+    }
+}
+
+/*
+ * Follow the packet of node 0 that starts at the state of nodes by
+ * splitting, and add the weight of its copies with each event to the
+ * estimates
+ */
+static void
+split_clone (sim_t *sim, const node_t *start, split_t *sp)
+{
+    const config_t *cfg = sim->cfg;
+    rare_t *rare = &sim->rare;
+    int j;
+
+    for (j = 0; j < cfg->node_count; j++) {
+        sp->key[j] = start[j].backoff;
+        sp->cw_size[j] = start[j].cw_size;
+    }
+    sp->log_count = 0;
+    sp->copy = ++sp->copies;
+    sp->paths = 1;
+    sp->drop = sp->starve = 0.0;
+    split_path(sim, sp, 0, 0, 0, cfg->retry_limit == 0,
+               cfg->starve_slots == 0, 1, 1.0);
+
+    rare->samples++;
+    rare->paths += sp->paths;
+    rare->drop_sum += sp->drop;
+    rare->drop_sq += sp->drop * sp->drop;
+    rare->starve_sum += sp->starve;
+    rare->starve_sq += sp->starve * sp->starve;
+}
+
+/*
+ * Simulate the saturated shared channel from transmission to transmission
+ * over the slot horizon, with the rules of the shared engine, and estimate
+ * how likely a packet of node 0 is to be dropped or starved. These events
+ * are too rare to count, so each packet that node 0 starts is also
+ * followed in a clone of the run, in which the other nodes draw their
+ * backoffs from a tilted distribution that makes them collide with node 0
+ * more often. The events of the clones, weighted by their likelihood
+ * ratios, are unbiased estimates of the probabilities in the run. With
+ * split set, the clones are split into copies instead. The clones draw
+ * from a stream of their own, so the run is the same whatever the tilt or
+ * the splitting.
+ */
+static int
+rare_run (const config_t *cfg, arena_t *arena, sim_t *out, int end)
+{
+    node_t *nodes, *clone;
+    split_t split;
+    unsigned int clone_seed = cfg->seed ^ RARE_SEED_SALT;
+    int n = cfg->node_count, len = cfg->pkt_size, busy = len + (len > 1);
+    int tries = 0, fresh, senders, start = 0, i = 0, m, c, j, k;
+    size_t depth;
+
+    memset(out, 0, sizeof(*out));
+    out->cfg = cfg;
+    out->seed = cfg->seed;
+    out->node_count = n;
+    out->nodes = nodes = arena_alloc(arena, n * sizeof(node_t));
+    clone = arena_alloc(arena, n * sizeof(node_t));
+
+    /* Each level of copies logs every node at most once */
+    memset(&split, 0, sizeof(split));
+    if (cfg->split > 0) {
+        depth = (size_t)(cfg->retry_limit + SPLIT_STARVE_LEVELS + 1) * n;
+        split.key = arena_alloc(arena, n * sizeof(long));
+        split.cw_size = arena_alloc(arena, n * sizeof(int));
+        split.saved = arena_alloc(arena, n * sizeof(int));
+        memset(split.saved, 0, n * sizeof(int));
+        split.log_node = arena_alloc(arena, depth * sizeof(int));
+        split.log_saved = arena_alloc(arena, depth * sizeof(int));
+        split.log_cw = arena_alloc(arena, depth * sizeof(int));
+        split.log_key = arena_alloc(arena, depth * sizeof(long));
+        split.seed = clone_seed;
+    }
+
+    for (c = 0, j = 0; c < cfg->class_count; c++) {
+        for (k = 0; k < cfg->classes[c].count; k++, j++) {
+            nodes[j].cw_size = cfg->classes[c].cw_size;
+            nodes[j].backoff = rand_r(&out->seed) % nodes[j].cw_size + 1;
+        }
+        out->class_end[c] = j;
+    }
+    if (cfg->split > 0) {
+        split_clone(out, nodes, &split);
+    } else {
+        rare_clone(out, nodes, clone, &clone_seed);
+    }
+
+    for (;;) {
+        for (m = nodes[0].backoff, j = 1; j < n; j++) {
+            m = (nodes[j].backoff < m) ? nodes[j].backoff : m;
+        }
+        if (i + m - 1 >= end) {
+            out->idle_slots += end - i;
+            i = end;
+            break;
+        }
+        out->idle_slots += m - 1 + busy - len;
+        i += m - 1;
+
+        for (senders = 0, j = 0; j < n; j++) {
+            nodes[j].backoff -= m;
+            senders += (nodes[j].backoff == 0);
+        }
+        if (senders == 1) {
+            out->transmission_slots += len;
+            out->packet_count++;
+        } else {
+            out->collision_slots += len;
+        }
+
+        /* A packet of node 0 that goes through, or collides once more */
+        fresh = (nodes[0].backoff == 0 && senders == 1);
+        if (fresh) {
+            out->rare.packets++;
+            out->rare.drops += (cfg->retry_limit > 0 &&
+                                tries >= cfg->retry_limit);
+            out->rare.starved += (cfg->starve_slots > 0 &&
+                                  i - start >= cfg->starve_slots);
+            tries = 0;
+            start = i + busy;
+        } else if (nodes[0].backoff == 0) {
+            tries++;
+        }
+
+        for (j = 0; j < n; j++) {
+            if (nodes[j].backoff > 0) {
+                continue;
+            }
+            if (senders > 1) {
+                if (nodes[j].cw_size < MAX_BACKOFF_CW) {
+                    nodes[j].cw_size *= 2;
+                }
+            } else if (cfg->policy == POLICY_RESET) {
+                nodes[j].cw_size = cfg->classes[sim_class_of(out, j)].cw_size;
+            }
+            nodes[j].backoff = rand_r(&out->seed) % nodes[j].cw_size + 1;
+        }
+        i += busy;
+
+        if (fresh && cfg->split > 0) {
+            split_clone(out, nodes, &split);
+        } else if (fresh) {
+            rare_clone(out, nodes, clone, &clone_seed);
+        }
+    }
+
+    out->slot = i;
+    return i;
+}
+
+/*
+ * Estimates of the drop and the starvation probabilities from the clones,
+ * each followed by its relative error: drop, drop error, starvation,
+ * starvation error. An event that no clone saw has an error of 0.
+ */
+static void
+rare_estimate (const rare_t *rare, double *est)
+{
+    const double *sum[2] = { &rare->drop_sum, &rare->starve_sum };
+    const double *sq[2] = { &rare->drop_sq, &rare->starve_sq };
+    double n = rare->samples, mean, var;
+    int k;
+
+    for (k = 0; k < 2; k++) {
+        mean = (n > 0) ? *sum[k] / n : 0.0;
+        var = (n > 1) ? (*sq[k] / n - mean * mean) * n / (n - 1) : 0.0;
+        est[2 * k] = mean;
+        est[2 * k + 1] = (mean > 0.0) ? sqrt(fmax(var, 0.0) / n) / mean : 0.0;
+    }
+}
+
+static double
+elapsed (const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Run the exact and the approximate (or mean-field) engines over the same
+ * fixed horizon and report how far apart they are
+ */
+static void
+approx_compare (const config_t *cfg, arena_t *arena)
+{
+    struct timespec start;
+    sim_t sim, approx;
+    double exact_time, approx_time, exact_eff, approx_eff;
+    const char *name = cfg->mean_field ? "Mean-field" : "Approximate";
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sim_alloc(&sim, arena, cfg, 0, cfg->slot_size);
+    sim_reset(&sim, NULL, cfg->seed);
+    sim_run(&sim, cfg->slot_size, 0);
+    exact_time = elapsed(&start);
+    arena_reset(arena);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (cfg->mean_field) {
+        meanfield_run(cfg, arena, &approx);
+    } else {
+        approx_run(cfg, &approx, cfg->slot_size, 0);
+    }
+    approx_time = elapsed(&start);
+
+    exact_eff = (double)sim.transmission_slots / cfg->slot_size;
+    approx_eff = (double)approx.transmission_slots / cfg->slot_size;
+
+    printf("Exact efficiency: %f (%d packets, %.3fs)\n", exact_eff,
+           sim.packet_count, exact_time);
+    printf("%s efficiency: %f (%d packets, %.3fs)\n", name, approx_eff,
+           approx.packet_count, approx_time);
+    printf("Deviation: %+f (%+.2f%%)\n", approx_eff - exact_eff,
+           exact_eff > 0.0 ? 100.0 * (approx_eff - exact_eff) / exact_eff : 0.0);
+}
+
+/*
+ * Measure the time from starting a run to the end of its first slot,
+ * averaged over the given number of runs from the same arena. This is the
+ * fixed cost paid by each of many short runs.
+ */
+static void
+bench_startup (const config_t *cfg, arena_t *arena, int runs)
+{
+    struct timespec start;
+    sim_t sim;
+    double total = 0.0, best = 0.0, t;
+    int r;
+
+    for (r = 0; r < runs; r++) {
+        arena_reset(arena);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        sim_alloc(&sim, arena, cfg, 0, cfg->slot_size);
+        sim_reset(&sim, NULL, cfg->seed + r);
+        sim_run(&sim, 1, 0);
+        t = elapsed(&start);
+
+        total += t;
+        if (r == 0 || t < best) {
+            best = t;
+        }
+    }
+
+    printf("Time to first slot: %.3f us mean, %.3f us best over %d runs\n",
+           1e6 * total / runs, 1e6 * best, runs);
+}
+
+/*
+ * Whether a run needs what only the exact sequential engine does: follow a
+ * changing population or offered load, aggregate frames, burst them in
+ * TXOPs, adapt their rate, keep energy records or share the channel with
+ * the management traffic of the AP
+ */
+static int
+config_extended (const config_t *cfg)
+{
+    return (cfg->churn_count > 0 || cfg->birth_rate > 0.0 ||
+            cfg->death_rate > 0.0 || cfg->window > 0 || cfg->load_count > 0 ||
+            config_frame_limit(cfg, MAX_RATES - 1) > 1 ||
+            cfg->subframe_error > 0.0 || cfg->txop_slots > 0 ||
+            cfg->rate_control != RATE_NONE || cfg->energy ||
+            cfg->beacon_interval > 0 || cfg->probe_rate > 0.0);
+}
+
+/*
+ * Whether a run estimates the odds of a rare event
+ */
+static int
+config_rare (const config_t *cfg)
+{
+    return (cfg->retry_limit > 0 || cfg->starve_slots > 0);
+}
+
+/*
+ * Check that a configuration is within the limits of the simulator
+ */
+static int
+config_valid (const config_t *cfg)
+{
+    int c, r = (cfg->rate_control == RATE_NONE) ? MAX_RATES - 1 : 0;
+
+    if ((cfg->pkt_size > MAX_PKT_SIZE) || (cfg->pkt_size < 1) ||
+        (cfg->node_count > MAX_NODE_COUNT) || (cfg->node_count < 1) ||
+        (cfg->slot_size < 1) || (cfg->segment_count < 0) ||
+        (cfg->segment_count > MAX_SEGMENT_COUNT) ||
+        (cfg->segment_count > cfg->slot_size) ||
+        (cfg->max_iterations < 0) ||
+        (cfg->approx && cfg->segment_count > 0) ||
+        (cfg->class_count < 1) ||
+        (cfg->class_count > 1 && cfg->segment_count > 0) ||
+        (cfg->node_capacity < cfg->node_count) ||
+        (cfg->node_capacity > MAX_NODE_COUNT) ||
+        (cfg->birth_rate < 0.0) || (cfg->death_rate < 0.0) ||
+        (cfg->window < 0) || (cfg->queue_limit < 1) ||
+        (cfg->agg_frames < 1) || (cfg->agg_frames > MAX_AGG_FRAMES) ||
+        (cfg->agg_slots < 0) || (cfg->subframe_slots < 1) ||
+        (cfg->subframe_error < 0.0) || (cfg->subframe_error >= 1.0) ||
+        (cfg->txop_slots < 0) || (cfg->txop_slots > MAX_TX_SLOTS) ||
+        (cfg->sifs_slots < 0) ||
+        (cfg->fixed_rate < 0) || (cfg->fixed_rate >= MAX_RATES) ||
+        (cfg->snr_spread < 0.0) ||
+        (cfg->ru_count < 0) || (cfg->ru_count > MAX_RUS) ||
+        (cfg->ocw_max < 1) || (cfg->ocw_max > MAX_BACKOFF_CW) ||
+        (cfg->trigger_slots < 0) ||
+        (cfg->power[ENERGY_TX] < 0.0) || (cfg->power[ENERGY_RX] < 0.0) ||
+        (cfg->power[ENERGY_IDLE] < 0.0) || (cfg->power[ENERGY_SLEEP] < 0.0) ||
+        (cfg->slot_time <= 0.0) || (cfg->frame_bits < 1) ||
+        (cfg->beacon_interval < 0) || (cfg->beacon_slots < 0) ||
+        (cfg->ssid_count < 1) || (cfg->probe_rate < 0.0) ||
+        (cfg->probe_slots < 1) || (cfg->dl_rate < 0.0) ||
+        (cfg->power_save &&
+         (cfg->beacon_interval == 0 || cfg->load_count == 0)) ||
+        (cfg->ap_load < 0.0) || (cfg->ap_queue < 1) ||
+        (cfg->ap_load > 0.0 && cfg->ap_class < 0) ||
+        (cfg->ap_class >= 0 && cfg->power_save) ||
+        (rate_slots(cfg->pkt_size, r) + (config_frame_limit(cfg, r) - 1) *
+         rate_slots(cfg->subframe_slots, r) > MAX_TX_SLOTS)) {
+        return 0;
+    }
+
+    if (config_extended(cfg) &&
+        (cfg->approx || cfg->segment_count > 0 || cfg->ru_count > 0)) {
+        return 0;
+    }
+
+    /* PS-Polls are single transmissions */
+    if (cfg->power_save &&
+        (config_frame_limit(cfg, MAX_RATES - 1) > 1 ||
+         cfg->subframe_error > 0.0 || cfg->txop_slots > 0 ||
+         cfg->rate_control != RATE_NONE)) {
+        return 0;
+    }
+
+    /*
+     * Topologies, the Markov chain and the mean field only cover saturated
+     * nodes sending single transmissions of fixed length. The mean field
+     * can be compared with the exact engine.
+     */
+    if ((cfg->topology != TOPO_SHARED || cfg->markov || cfg->mean_field) &&
+        (config_extended(cfg) || cfg->approx || cfg->segment_count > 0 ||
+         cfg->ru_count > 0 || (cfg->compare && !cfg->mean_field))) {
+        return 0;
+    }
+    if (cfg->mean_field && (cfg->markov || cfg->topology != TOPO_SHARED)) {
+        return 0;
+    }
+
+    /* Rare-event estimation has an engine of its own, for the same runs */
+    if ((cfg->retry_limit < 0) || (cfg->starve_slots < 0) ||
+        (cfg->tilt < 1.0) || (cfg->split < 0) || (cfg->split > MAX_SPLIT)) {
+        return 0;
+    }
+    if (config_rare(cfg) &&
+        (config_extended(cfg) || cfg->approx || cfg->segment_count > 0 ||
+         cfg->ru_count > 0 || cfg->compare || cfg->markov ||
+         cfg->mean_field || cfg->topology != TOPO_SHARED)) {
+        return 0;
+    }
+    if (cfg->markov &&
+        (cfg->topology != TOPO_SHARED || cfg->class_count > 1 ||
+         cfg->node_count > MAX_MARKOV_NODES || cfg->max_stage < 0 ||
+         cfg->max_stage > MAX_MARKOV_STAGE ||
+         (long)cfg->cw_size * ((2L << cfg->max_stage) - 1) >
+         MAX_MARKOV_COUNTERS)) {
+        return 0;
+    }
+    if ((cfg->topology == TOPO_GEOMETRIC &&
+         (cfg->area <= 0.0 || cfg->area > MAX_TOPO_AREA)) ||
+        (cfg->range_spread < 0.0) || (cfg->range_spread >= 1.0) ||
+        (cfg->link_distance < 0.0) || (cfg->link_distance > 1.0)) {
+        return 0;
+    }
+    for (c = 0; c < cfg->edge_count; c++) {
+        if ((cfg->edges[c].from < 0) ||
+            (cfg->edges[c].from >= cfg->node_count) ||
+            (cfg->edges[c].to < 0) || (cfg->edges[c].to >= cfg->node_count) ||
+            (cfg->edges[c].from == cfg->edges[c].to)) {
+            return 0;
+        }
+    }
+
+    /* UORA has an engine of its own */
+    if (cfg->ru_count > 0 &&
+        (cfg->approx || cfg->segment_count > 0 || cfg->compare)) {
+        return 0;
+    }
+
+    for (c = 0; c < cfg->load_count; c++) {
+        if ((cfg->load[c].slot < 0) || (cfg->load[c].rate < 0.0) ||
+            (cfg->load[c].class_index < 0) ||
+            (cfg->load[c].class_index >= cfg->class_count)) {
+            return 0;
+        }
+    }
+
+    for (c = 0; c < cfg->churn_count; c++) {
+        if ((cfg->churn[c].slot < 0) ||
+            (cfg->churn[c].class_index < 0) ||
+            (cfg->churn[c].class_index >= cfg->class_count) ||
+            (cfg->churn[c].class_index == cfg->ap_class)) {
+            return 0;
+        }
+    }
+
+    /* The OCW of a UORA class starts at its CW and doubles up to ocw_max */
+    for (c = 0; c < cfg->class_count; c++) {
+        if ((cfg->classes[c].count < 1) ||
+            (cfg->classes[c].cw_size > MAX_CW_SIZE) ||
+            (cfg->classes[c].cw_size < 1) ||
+            (cfg->ru_count > 0 && cfg->classes[c].cw_size > cfg->ocw_max)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Add a change of the offered load of a class, keeping the schedule in
+ * slot order
+ */
+static int
+config_load (config_t *cfg, int slot, double rate, int class_index)
+{
+    int k;
+
+    if (cfg->load_count == MAX_LOAD_EVENTS) {
+        return -1;
+    }
+
+    for (k = cfg->load_count++; k > 0 && cfg->load[k - 1].slot > slot; k--) {
+        cfg->load[k] = cfg->load[k - 1];
+    }
+    cfg->load[k].slot = slot;
+    cfg->load[k].rate = rate;
+    cfg->load[k].class_index = class_index;
+    return 0;
+}
+
+/*
+ * Fill in the derived parameters. The node count and the reported CW come
+ * from the node classes, and without any classes node_count and cw_size
+ * make up a single one. Unless given, the node capacity is the most nodes
+ * the churn script can bring, with headroom for random arrivals, and
+ * subframes take SUBFRAME_SHARE of a packet. With downlink traffic, the AP
+ * is added as the last class, on top of any node capacity given, and the
+ * downlink load starts at the first slot.
+ */
+static void
+config_finish (config_t *cfg)
+{
+    long total = 0;
+    int c;
+
+    if (cfg->class_count == 0) {
+        cfg->classes[0].count = cfg->node_count;
+        cfg->classes[0].cw_size = cfg->cw_size;
+        cfg->class_count = 1;
+    }
+
+    cfg->ap_class = -1;
+    if (cfg->ap_load > 0.0 && cfg->class_count < MAX_NODE_CLASSES &&
+        config_load(cfg, 0, cfg->ap_load, cfg->class_count) == 0) {
+        cfg->ap_class = cfg->class_count++;
+        cfg->classes[cfg->ap_class].count = 1;
+        cfg->classes[cfg->ap_class].cw_size = cfg->ap_cw ? cfg->ap_cw :
+                                              cfg->classes[0].cw_size;
+        if (cfg->node_capacity > 0) {
+            cfg->node_capacity++;
+        }
+    }
+
+    for (c = 0; c < cfg->class_count; c++) {
+        total += cfg->classes[c].count;
+    }
+    cfg->node_count = (total > MAX_NODE_COUNT) ? MAX_NODE_COUNT + 1 : total;
+    cfg->cw_size = cfg->classes[0].cw_size;
+
+    if (cfg->node_capacity == 0) {
+        for (c = 0; c < cfg->churn_count; c++) {
+            total += (cfg->churn[c].delta > 0) ? cfg->churn[c].delta : 0;
+        }
+        if (cfg->birth_rate > 0.0) {
+            total *= CHURN_HEADROOM;
+        }
+        cfg->node_capacity = (total > MAX_NODE_COUNT) ? MAX_NODE_COUNT : total;
+    }
+
+    if (cfg->subframe_slots == 0) {
+        cfg->subframe_slots = (int)ceil(cfg->pkt_size * SUBFRAME_SHARE);
+    }
+}
+
+static int
+parse_policy (const char *name, int *policy)
+{
+    if (strcmp(name, "double") == 0) {
+        *policy = POLICY_DOUBLE;
+    } else if (strcmp(name, "reset") == 0) {
+        *policy = POLICY_RESET;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+parse_aggregation (const char *name, int *aggregation)
+{
+    if (strcmp(name, "none") == 0) {
+        *aggregation = AGG_NONE;
+    } else if (strcmp(name, "ampdu") == 0) {
+        *aggregation = AGG_AMPDU;
+    } else if (strcmp(name, "amsdu") == 0) {
+        *aggregation = AGG_AMSDU;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+parse_rate_control (const char *name, int *rate_control)
+{
+    if (strcmp(name, "none") == 0) {
+        *rate_control = RATE_NONE;
+    } else if (strcmp(name, "fixed") == 0) {
+        *rate_control = RATE_FIXED;
+    } else if (strcmp(name, "arf") == 0) {
+        *rate_control = RATE_ARF;
+    } else if (strcmp(name, "aarf") == 0) {
+        *rate_control = RATE_AARF;
+    } else if (strcmp(name, "minstrel") == 0) {
+        *rate_control = RATE_MINSTREL;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Parse a whole string as an integer
+ */
+static int
+parse_int (const char *str, int *value)
+{
+    char *end;
+    long v = strtol(str, &end, 0);
+
+    if (end == str || *end != '\0' || v < INT32_MIN || v > INT32_MAX) {
+        return -1;
+    }
+
+    *value = (int)v;
+    return 0;
+}
+
+static int
+parse_double (const char *str, double *value)
+{
+    char *end;
+
+    *value = strtod(str, &end);
+    return (end == str || *end != '\0') ? -1 : 0;
+}
+
+/*
+ * Parse a rate in Mbps into its index in the rate table
+ */
+static int
+parse_rate (const char *str, int *rate)
+{
+    double mbps;
+    int r;
+
+    if (parse_double(str, &mbps)) {
+        return -1;
+    }
+    for (r = 0; r < MAX_RATES; r++) {
+        if (mbps == rate_mbps[r]) {
+            *rate = r;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Split value into at most max blank separated fields. Returns the number
+ * of fields, or -1 if there are more.
+ */
+static int
+split_fields (char *value, char **field, int max)
+{
+    int n;
+
+    for (n = 0; n < max && *value != '\0'; n++) {
+        field[n] = value;
+        value += strcspn(value, " \t");
+        if (*value != '\0') {
+            *value++ = '\0';
+            value += strspn(value, " \t");
+        }
+    }
+
+    return (*value != '\0') ? -1 : n;
+}
+
+/*
+ * Add a scripted join (sign 1) or leave (sign -1) given as
+ * "<slot> <count> [<class>]", keeping the script in slot order
+ */
+static int
+scenario_churn (config_t *cfg, char *value, int sign)
+{
+    churn_t ev = { 0, 0, 0 };
+    char *field[3];
+    int n, k;
+
+    n = split_fields(value, field, 3);
+    if (n < 2 || cfg->churn_count == MAX_CHURN_EVENTS ||
+        parse_int(field[0], &ev.slot) || parse_int(field[1], &ev.delta) ||
+        (n == 3 && parse_int(field[2], &ev.class_index)) || ev.delta < 0) {
+        return -1;
+    }
+    ev.delta *= sign;
+
+    for (k = cfg->churn_count++; k > 0 && cfg->churn[k - 1].slot > ev.slot;
+         k--) {
+        cfg->churn[k] = cfg->churn[k - 1];
+    }
+    cfg->churn[k] = ev;
+    return 0;
+}
+
+/*
+ * Add the topology links of a "hears = <node> <node>..." line, on which
+ * the first node hears the others, or of a "reaches = <node> <node>..."
+ * line, on which the first node reaches the receivers of the others. The
+ * edge array is moved to a larger one on arena when it is full.
+ */
+static int
+scenario_edges (config_t *cfg, arena_t *arena, char *value, int kind)
+{
+    char *field[MAX_LINE_LEN / 2];
+    topo_edge_t *e;
+    int n, k, node, other;
+
+    n = split_fields(value, field, MAX_LINE_LEN / 2);
+    if (n < 2 || parse_int(field[0], &node)) {
+        return -1;
+    }
+
+    for (k = 1; k < n; k++) {
+        if (parse_int(field[k], &other)) {
+            return -1;
+        }
+        if (cfg->edge_count == cfg->edge_room) {
+            cfg->edge_room = cfg->edge_room ? 2 * cfg->edge_room :
+                                              TOPO_EDGE_ROOM;
+            e = arena_alloc(arena, cfg->edge_room * sizeof(topo_edge_t));
+            if (cfg->edge_count > 0) {
+                memcpy(e, cfg->edges, cfg->edge_count * sizeof(topo_edge_t));
+            }
+            cfg->edges = e;
+        }
+        e = &cfg->edges[cfg->edge_count++];
+        e->from = (kind == TOPO_HEAR) ? other : node;
+        e->to = (kind == TOPO_HEAR) ? node : other;
+        e->kind = kind;
+    }
+    cfg->topology = TOPO_LINKS;
+    return 0;
+}
+
+/*
+ * Set the mean SNR given as "<dB> [<class>]", of every class if no class is
+ * given
+ */
+static int
+scenario_snr (config_t *cfg, char *value)
+{
+    char *field[2];
+    double snr;
+    int n, c;
+
+    n = split_fields(value, field, 2);
+    if (n < 1 || parse_double(field[0], &snr)) {
+        return -1;
+    }
+    if (n == 2) {
+        if (parse_int(field[1], &c) || c < 0 || c >= MAX_NODE_CLASSES) {
+            return -1;
+        }
+        cfg->snr[c] = snr;
+        return 0;
+    }
+
+    for (c = 0; c < MAX_NODE_CLASSES; c++) {
+        cfg->snr[c] = snr;
+    }
+    return 0;
+}
+
+/*
+ * Add a load step given as "<slot> <rate> [<class>]", or a ramp given as
+ * "<start> <end> <from> <to> <steps> [<class>]". A ramp is a staircase of
+ * steps load steps from the rate from at slot start to the rate to at slot
+ * end, so that it is precomputed like any other step.
+ */
+static int
+scenario_load_step (config_t *cfg, char *value, int ramp)
+{
+    char *field[6];
+    int n, slot, end = 0, steps = 1, class_index = 0, k;
+    double rate, to = 0.0;
+
+    n = split_fields(value, field, ramp ? 6 : 3);
+    if (n < (ramp ? 5 : 2) || parse_int(field[0], &slot) ||
+        (ramp && (parse_int(field[1], &end) ||
+                  parse_double(field[3], &to) ||
+                  parse_int(field[4], &steps) || steps < 2 || end <= slot)) ||
+        parse_double(field[ramp ? 2 : 1], &rate) ||
+        (n == (ramp ? 6 : 3) &&
+         parse_int(field[n - 1], &class_index))) {
+        return -1;
+    }
+
+    for (k = 0; k < steps; k++) {
+        if (config_load(cfg, slot + (int)((double)(end - slot) * k /
+                                          (steps > 1 ? steps - 1 : 1)),
+                        ramp ? rate + (to - rate) * k / (steps - 1) : rate,
+                        class_index) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Apply one key = value line of a scenario file. The first class line of a
+ * section replaces the classes inherited from the defaults, and so does the
+ * first join or leave line for the churn script, and the first topology
+ * link, which starts an edge array of the section's own on arena. A
+ * node_count or cw_size line drops the inherited classes instead, and
+ * can't share a section with class lines.
+ */
+static int
+scenario_set (scenario_t *sc, arena_t *arena, const char *key, char *value,
+              int *replaced)
+{
+    config_t *cfg = &sc->cfg;
+    char *cw;
+
+    if (strcmp(key, "pkt_size") == 0) {
+        return parse_int(value, &cfg->pkt_size);
+    } else if (strcmp(key, "node_count") == 0 ||
+               strcmp(key, "cw_size") == 0) {
+        if (*replaced & SCENARIO_CLASSES) {
+            return -1;
+        }
+        cfg->class_count = 0;
+        *replaced |= SCENARIO_NODES;
+        return parse_int(value, (key[0] == 'n') ? &cfg->node_count :
+                                                  &cfg->cw_size);
+    } else if (strcmp(key, "class") == 0) {
+        if (*replaced & SCENARIO_NODES) {
+            return -1;
+        }
+        if (!(*replaced & SCENARIO_CLASSES)) {
+            cfg->class_count = 0;
+            *replaced |= SCENARIO_CLASSES;
+        }
+        cw = strpbrk(value, " \t");
+        if (cfg->class_count == MAX_NODE_CLASSES || cw == NULL) {
+            return -1;
+        }
+        *cw++ = '\0';
+        cw += strspn(cw, " \t");
+        if (parse_int(value, &cfg->classes[cfg->class_count].count) ||
+            parse_int(cw, &cfg->classes[cfg->class_count].cw_size)) {
+            return -1;
+        }
+        cfg->class_count++;
+        return 0;
+    } else if (strcmp(key, "policy") == 0) {
+        return parse_policy(value, &cfg->policy);
+    } else if (strcmp(key, "engine") == 0) {
+        cfg->approx = cfg->markov = cfg->mean_field = 0;
+        if (strcmp(value, "approx") == 0) {
+            cfg->approx = 1;
+        } else if (strcmp(value, "markov") == 0) {
+            cfg->markov = 1;
+        } else if (strcmp(value, "meanfield") == 0) {
+            cfg->mean_field = 1;
+        } else if (strcmp(value, "exact") != 0) {
+            return -1;
+        }
+        return 0;
+    } else if (strcmp(key, "slots") == 0) {
+        return parse_int(value, &cfg->slot_size);
+    } else if (strcmp(key, "stop") == 0) {
+        if (strcmp(value, "converge") == 0) {
+            cfg->fixed = 0;
+        } else if (strcmp(value, "fixed") == 0) {
+            cfg->fixed = 1;
+        } else {
+            return -1;
+        }
+        return 0;
+    } else if (strcmp(key, "replications") == 0) {
+        return parse_int(value, &sc->replications);
+    } else if (strcmp(key, "seed") == 0) {
+        cfg->seed = strtoul(value, NULL, 0);
+        return 0;
+    } else if (strcmp(key, "output") == 0) {
+        if (strlen(value) >= MAX_PATH_LEN) {
+            return -1;
+        }
+        strcpy(sc->output, value);
+        return 0;
+    } else if (strcmp(key, "join") == 0 || strcmp(key, "leave") == 0) {
+        if (!(*replaced & SCENARIO_CHURN)) {
+            cfg->churn_count = 0;
+            *replaced |= SCENARIO_CHURN;
+        }
+        return scenario_churn(cfg, value, (key[0] == 'j') ? 1 : -1);
+    } else if (strcmp(key, "max_nodes") == 0) {
+        return parse_int(value, &cfg->node_capacity);
+    } else if (strcmp(key, "birth_rate") == 0) {
+        return parse_double(value, &cfg->birth_rate);
+    } else if (strcmp(key, "death_rate") == 0) {
+        return parse_double(value, &cfg->death_rate);
+    } else if (strcmp(key, "window") == 0) {
+        return parse_int(value, &cfg->window);
+    } else if (strcmp(key, "window_output") == 0) {
+        if (strlen(value) >= MAX_PATH_LEN) {
+            return -1;
+        }
+        strcpy(sc->window_output, value);
+        return 0;
+    } else if (strcmp(key, "load") == 0 || strcmp(key, "ramp") == 0) {
+        if (!(*replaced & SCENARIO_LOAD)) {
+            cfg->load_count = 0;
+            *replaced |= SCENARIO_LOAD;
+        }
+        return scenario_load_step(cfg, value, key[0] == 'r');
+    } else if (strcmp(key, "queue_limit") == 0) {
+        return parse_int(value, &cfg->queue_limit);
+    } else if (strcmp(key, "aggregation") == 0) {
+        return parse_aggregation(value, &cfg->aggregation);
+    } else if (strcmp(key, "agg_frames") == 0) {
+        return parse_int(value, &cfg->agg_frames);
+    } else if (strcmp(key, "agg_slots") == 0) {
+        return parse_int(value, &cfg->agg_slots);
+    } else if (strcmp(key, "subframe_slots") == 0) {
+        return parse_int(value, &cfg->subframe_slots);
+    } else if (strcmp(key, "subframe_error") == 0) {
+        return parse_double(value, &cfg->subframe_error);
+    } else if (strcmp(key, "txop") == 0) {
+        return parse_int(value, &cfg->txop_slots);
+    } else if (strcmp(key, "sifs_slots") == 0) {
+        return parse_int(value, &cfg->sifs_slots);
+    } else if (strcmp(key, "rate_control") == 0) {
+        return parse_rate_control(value, &cfg->rate_control);
+    } else if (strcmp(key, "fixed_rate") == 0) {
+        return parse_rate(value, &cfg->fixed_rate);
+    } else if (strcmp(key, "snr") == 0) {
+        return scenario_snr(cfg, value);
+    } else if (strcmp(key, "snr_spread") == 0) {
+        return parse_double(value, &cfg->snr_spread);
+    } else if (strcmp(key, "ru_count") == 0) {
+        return parse_int(value, &cfg->ru_count);
+    } else if (strcmp(key, "ocw_max") == 0) {
+        return parse_int(value, &cfg->ocw_max);
+    } else if (strcmp(key, "trigger_slots") == 0) {
+        return parse_int(value, &cfg->trigger_slots);
+    } else if (strcmp(key, "tx_power") == 0) {
+        return parse_double(value, &cfg->power[ENERGY_TX]);
+    } else if (strcmp(key, "rx_power") == 0) {
+        return parse_double(value, &cfg->power[ENERGY_RX]);
+    } else if (strcmp(key, "idle_power") == 0) {
+        return parse_double(value, &cfg->power[ENERGY_IDLE]);
+    } else if (strcmp(key, "sleep_power") == 0) {
+        return parse_double(value, &cfg->power[ENERGY_SLEEP]);
+    } else if (strcmp(key, "slot_time") == 0) {
+        return parse_double(value, &cfg->slot_time);
+    } else if (strcmp(key, "frame_bits") == 0) {
+        return parse_int(value, &cfg->frame_bits);
+    } else if (strcmp(key, "beacon_interval") == 0) {
+        return parse_int(value, &cfg->beacon_interval);
+    } else if (strcmp(key, "beacon_slots") == 0) {
+        return parse_int(value, &cfg->beacon_slots);
+    } else if (strcmp(key, "ssid_count") == 0) {
+        return parse_int(value, &cfg->ssid_count);
+    } else if (strcmp(key, "probe_rate") == 0) {
+        return parse_double(value, &cfg->probe_rate);
+    } else if (strcmp(key, "probe_slots") == 0) {
+        return parse_int(value, &cfg->probe_slots);
+    } else if (strcmp(key, "power_save") == 0) {
+        if (strcmp(value, "on") == 0) {
+            cfg->power_save = 1;
+        } else if (strcmp(value, "off") == 0) {
+            cfg->power_save = 0;
+        } else {
+            return -1;
+        }
+        return 0;
+    } else if (strcmp(key, "dl_rate") == 0) {
+        return parse_double(value, &cfg->dl_rate);
+    } else if (strcmp(key, "ap_load") == 0) {
+        return parse_double(value, &cfg->ap_load);
+    } else if (strcmp(key, "ap_cw") == 0) {
+        return parse_int(value, &cfg->ap_cw);
+    } else if (strcmp(key, "ap_queue") == 0) {
+        return parse_int(value, &cfg->ap_queue);
+    } else if (strcmp(key, "max_stage") == 0) {
+        return parse_int(value, &cfg->max_stage);
+    } else if (strcmp(key, "topology") == 0) {
+        if (strcmp(value, "shared") == 0) {
+            cfg->topology = TOPO_SHARED;
+        } else if (strcmp(value, "geometric") == 0) {
+            cfg->topology = TOPO_GEOMETRIC;
+        } else if (strcmp(value, "links") == 0) {
+            cfg->topology = TOPO_LINKS;
+        } else {
+            return -1;
+        }
+        return 0;
+    } else if (strcmp(key, "area") == 0) {
+        return parse_double(value, &cfg->area);
+    } else if (strcmp(key, "range_spread") == 0) {
+        return parse_double(value, &cfg->range_spread);
+    } else if (strcmp(key, "link_distance") == 0) {
+        return parse_double(value, &cfg->link_distance);
+    } else if (strcmp(key, "hears") == 0 || strcmp(key, "reaches") == 0) {
+        if (!(*replaced & SCENARIO_EDGES)) {
+            cfg->edges = NULL;
+            cfg->edge_count = cfg->edge_room = 0;
+            *replaced |= SCENARIO_EDGES;
+        }
+        return scenario_edges(cfg, arena, value,
+                              (key[0] == 'h') ? TOPO_HEAR : TOPO_REACH);
+    } else if (strcmp(key, "topology_output") == 0) {
+        if (strlen(value) >= MAX_PATH_LEN) {
+            return -1;
+        }
+        strcpy(sc->topology_output, value);
+        return 0;
+    } else if (strcmp(key, "retry_limit") == 0) {
+        return parse_int(value, &cfg->retry_limit);
+    } else if (strcmp(key, "starve_slots") == 0) {
+        return parse_int(value, &cfg->starve_slots);
+    } else if (strcmp(key, "tilt") == 0) {
+        return parse_double(value, &cfg->tilt);
+    } else if (strcmp(key, "split") == 0) {
+        return parse_int(value, &cfg->split);
+    } else if (strcmp(key, "rare_output") == 0) {
+        if (strlen(value) >= MAX_PATH_LEN) {
+            return -1;
+        }
+        strcpy(sc->rare_output, value);
+        return 0;
+    } else if (strcmp(key, "flow_output") == 0) {
+        if (strlen(value) >= MAX_PATH_LEN) {
+            return -1;
+        }
+        strcpy(sc->flow_output, value);
+        return 0;
+    } else if (strcmp(key, "energy_output") == 0) {
+        if (strlen(value) >= MAX_PATH_LEN) {
+            return -1;
+        }
+        strcpy(sc->energy_output, value);
+        cfg->energy = 1;
+        return 0;
+    } else if (strcmp(key, "ru_output") == 0) {
+        if (strlen(value) >= MAX_PATH_LEN) {
+            return -1;
+        }
+        strcpy(sc->ru_output, value);
+        return 0;
+    } else if (strcmp(key, "rate_output") == 0) {
+        if (strlen(value) >= MAX_PATH_LEN) {
+            return -1;
+        }
+        strcpy(sc->rate_output, value);
+        return 0;
+    } else if (strcmp(key, "phase_output") == 0) {
+        if (strlen(value) >= MAX_PATH_LEN) {
+            return -1;
+        }
+        strcpy(sc->phase_output, value);
+        return 0;
+    }
+
+    return -1;
+}
+
+static char *
+trim (char *str)
+{
+    char *end;
+
+    str += strspn(str, " \t\r\n");
+    end = str + strlen(str);
+    while (end > str && strchr(" \t\r\n", end[-1]) != NULL) {
+        *--end = '\0';
+    }
+
+    return str;
+}
+
+/*
+ * Read the scenarios of an INI style file. Keys before the first [name]
+ * section are defaults for every scenario, on top of the command line
+ * options. A file without sections is a single scenario. Lines may be up to
+ * MAX_LINE_LEN - 2 characters long. Topology links are allocated from
+ * arena. Exits on errors.
+ *
+ * Returns the number of scenarios.
+ */
+static int
+scenario_load (const char *path, const config_t *base, arena_t *arena,
+               scenario_t *scenarios)
+{
+    scenario_t defaults, *sc = &defaults;
+    char buf[MAX_LINE_LEN], *line, *value;
+    int count = 0, line_no = 0, replaced = 0, c;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        printf("Unable to open %s!\n", path);
+        exit(1);
+    }
+
+    memset(&defaults, 0, sizeof(defaults));
+    defaults.cfg = *base;
+    defaults.replications = 1;
+    strcpy(defaults.name, "default");
+
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        line_no++;
+        if (strchr(buf, '\n') == NULL && (c = getc(fp)) != EOF) {
+            ungetc(c, fp);
+            break;
+        }
+        line = buf;
+        line[strcspn(line, "#;")] = '\0';
+        line = trim(line);
+        if (*line == '\0') {
+            continue;
+        }
+
+        if (*line == '[') {
+            value = strchr(line, ']');
+            if (value == NULL || value[1] != '\0' ||
+                value - line - 1 >= MAX_NAME_LEN || count == MAX_SCENARIOS) {
+                break;
+            }
+            *value = '\0';
+            sc = &scenarios[count++];
+            *sc = defaults;
+            strcpy(sc->name, trim(line + 1));
+            replaced = 0;
+            continue;
+        }
+
+        value = strchr(line, '=');
+        if (value == NULL) {
+            break;
+        }
+        *value++ = '\0';
+        if (scenario_set(sc, arena, trim(line), trim(value),
+                         &replaced) != 0) {
+            break;
+        }
+    }
+
+    if (!feof(fp)) {
+        printf("Error in %s, line %d!\n", path, line_no);
+        exit(1);
+    }
+    fclose(fp);
+
+    if (count == 0) {
+        scenarios[count++] = defaults;
+    }
+
+    for (c = 0; c < count; c++) {
+        config_finish(&scenarios[c].cfg);
+        if (!config_valid(&scenarios[c].cfg) ||
+            scenarios[c].replications < 1) {
+            printf("Error in %s, scenario %s!\n", path, scenarios[c].name);
+            exit(1);
+        }
+    }
+
+    return count;
+}
+
+/*
+ * Statistics over window or phase k of a run
+ */
+static void
+window_stats (const window_t *windows, int k, stats_t *st)
+{
+    static const window_t origin;
+    const window_t *prev = (k > 0) ? &windows[k - 1] : &origin;
+    const window_t *win = &windows[k];
+    double len = win->slot - prev->slot;
+    int packets = win->packet_count - prev->packet_count;
+
+    st->start = prev->slot;
+    st->end = win->slot;
+    st->nodes = (win->node_slots - prev->node_slots) / len;
+    st->efficiency = (win->transmission_slots - prev->transmission_slots) /
+                     len;
+    st->throughput = packets / len;
+    st->offered = (win->arrivals - prev->arrivals) / len;
+    st->delay = packets ? (win->delay_sum - prev->delay_sum) / packets : 0.0;
+    st->drops = win->drops - prev->drops;
+}
+
+static void
+window_print (const char *what, const window_t *windows, int count,
+              int saturated)
+{
+    stats_t st;
+    int k;
+
+    for (k = 0; k < count; k++) {
+        window_stats(windows, k, &st);
+        printf("%s %d-%d: nodes %.1f, efficiency %f, throughput %f", what,
+               st.start, st.end, st.nodes, st.efficiency, st.throughput);
+        if (!saturated) {
+            printf(", offered %f, delay %.1f, drops %d", st.offered,
+                   st.delay, st.drops);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Run cfg once from the start, with the exact or the approximate engine.
+ * Returns the number of slots used, or -1 if the Markov chain is too big to
+ * solve.
+ */
+static int
+run_once (const config_t *cfg, arena_t *arena, sim_t *sim)
+{
+    if (cfg->approx) {
+        return approx_run(cfg, sim, cfg->slot_size, !cfg->fixed);
+    }
+    if (cfg->ru_count > 0) {
+        return uora_run(cfg, arena, sim, cfg->slot_size, !cfg->fixed);
+    }
+    if (cfg->topology != TOPO_SHARED) {
+        return topo_run(cfg, arena, sim, cfg->slot_size, !cfg->fixed);
+    }
+    if (cfg->markov) {
+        return markov_run(cfg, arena, sim);
+    }
+    if (cfg->mean_field) {
+        return meanfield_run(cfg, arena, sim);
+    }
+    if (config_rare(cfg)) {
+        return rare_run(cfg, arena, sim, cfg->slot_size);
+    }
+
+    sim_alloc(sim, arena, cfg, 0, cfg->slot_size);
+    sim_reset(sim, NULL, cfg->seed);
+    return sim_run(sim, cfg->slot_size, !cfg->fixed);
+}
+
+static void *
+batch_thread (void *arg)
+{
+    worker_t *worker = arg;
+    batch_t *batch = worker->batch;
+    scenario_t *sc = batch->scenarios;
+    result_t *res;
+    config_t cfg;
+    sim_t sim;
+    int job, c;
+
+    if (config.pin) {
+        pin_worker(worker->index);
+    }
+
+    while ((job = __atomic_fetch_add(&batch->next_job, 1,
+                                     __ATOMIC_RELAXED)) < batch->job_count) {
+        while (job >= sc->first_job + sc->replications) {
+            sc++;
+        }
+
+        cfg = sc->cfg;
+        cfg.seed += job - sc->first_job;
+        arena_reset(&worker->arena);
+
+        res = &batch->results[job];
+        res->slots = run_once(&cfg, &worker->arena, &sim);
+        res->converged = res->slots >= 0 &&
+                         (cfg.fixed || cfg.markov || cfg.mean_field ||
+                          config_rare(&cfg) || res->slots < cfg.slot_size);
+        res->idle_slots = sim.idle_slots;
+        res->collision_slots = sim.collision_slots;
+        res->transmission_slots = sim.transmission_slots;
+        res->packet_count = sim.packet_count;
+        res->lost_frames = sim.lost_frames;
+        if (cfg.ru_count > 0) {
+            res->triggers = sim.triggers;
+            memcpy(res->ru_success, sim.ru_success, sizeof(res->ru_success));
+            memcpy(res->ru_collision, sim.ru_collision,
+                   sizeof(res->ru_collision));
+        }
+        if (cfg.energy) {
+            for (c = 0; c < cfg.class_count; c++) {
+                res->delivered[c] = sim_energy_class(&sim, c, res->energy[c]);
+            }
+        }
+        if (cfg.ap_class >= 0) {
+            sim_flows(&sim, res->flows);
+        }
+        if (cfg.markov || cfg.mean_field) {
+            res->model_efficiency = sim.model_efficiency;
+            res->model_throughput = sim.model_throughput;
+        }
+        if (config_rare(&cfg)) {
+            res->rare = sim.rare;
+        }
+        if (cfg.topology != TOPO_SHARED) {
+            res->hear_links = sim.hear_links;
+            res->one_way = sim.one_way;
+            res->reach_links = sim.reach_links;
+            res->deferrals = sim.deferrals;
+            res->exposed = sim.exposed;
+            res->fairness = sim.fairness;
+        }
+        if (cfg.rate_control != RATE_NONE) {
+            memcpy(res->rate_attempts, sim.rate_attempts,
+                   sizeof(res->rate_attempts));
+            memcpy(res->rate_delivered, sim.rate_delivered,
+                   sizeof(res->rate_delivered));
+        }
+        if (res->windows != NULL) {
+            memcpy(res->windows, sim.windows,
+                   sim.window_count * sizeof(window_t));
+            res->window_count = sim.window_count;
+        }
+        if (res->phases != NULL) {
+            memcpy(res->phases, sim.phases,
+                   sim.phase_count * sizeof(window_t));
+            res->phase_count = sim.phase_count;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Whether scenario sc writes to the file at path. A per-window, per-phase,
+ * per-rate, per-RU, energy, per-direction or topology file is only written
+ * if the scenario has any.
+ */
+static int
+batch_writes (const scenario_t *sc, const char *path)
+{
+    const config_t *cfg = &sc->cfg;
+
+    return (strcmp(sc->output, path) == 0 ||
+            (cfg->window > 0 && strcmp(sc->window_output, path) == 0) ||
+            (cfg->load_count > 0 && strcmp(sc->phase_output, path) == 0) ||
+            (cfg->rate_control != RATE_NONE &&
+             strcmp(sc->rate_output, path) == 0) ||
+            (cfg->ru_count > 0 && strcmp(sc->ru_output, path) == 0) ||
+            (cfg->energy && strcmp(sc->energy_output, path) == 0) ||
+            (cfg->ap_class >= 0 && strcmp(sc->flow_output, path) == 0) ||
+            (cfg->topology != TOPO_SHARED &&
+             strcmp(sc->topology_output, path) == 0) ||
+            (config_rare(cfg) && strcmp(sc->rare_output, path) == 0));
+}
+
+/*
+ * Open a CSV output of scenario s for writing. The first scenario to write
+ * a file creates it with the header, later ones append to it.
+ */
+static FILE *
+batch_open (const batch_t *batch, int s, const char *path, const char *header)
+{
+    FILE *fp;
+    int t;
+
+    for (t = 0; t < s && !batch_writes(&batch->scenarios[t], path); t++);
+
+    fp = fopen(path, (t < s) ? "a" : "w");
+    if (fp == NULL) {
+        printf("Unable to open %s!\n", path);
+        exit(1);
+    }
+    if (t == s) {
+        fprintf(fp, "%s\n", header);
+    }
+
+    return fp;
+}
+
+/*
+ * Write the stats windows (or the load phases if phases is set) of every
+ * replication of scenario s
+ */
+static void
+batch_windows (const batch_t *batch, int s, int phases)
+{
+    const scenario_t *sc = &batch->scenarios[s];
+    const result_t *res;
+    stats_t st;
+    int r, k, count;
+    FILE *fp;
+
+    fp = batch_open(batch, s, phases ? sc->phase_output : sc->window_output,
+                    "scenario,replication,start,end,nodes,efficiency,"
+                    "throughput,offered,delay,drops");
+    for (r = 0; r < sc->replications; r++) {
+        res = &batch->results[sc->first_job + r];
+        count = phases ? res->phase_count : res->window_count;
+        for (k = 0; k < count; k++) {
+            window_stats(phases ? res->phases : res->windows, k, &st);
+            fprintf(fp, "%s,%d,%d,%d,%f,%f,%f,%f,%f,%d\n", sc->name, r,
+                    st.start, st.end, st.nodes, st.efficiency, st.throughput,
+                    st.offered, st.delay, st.drops);
+        }
+    }
+    fclose(fp);
+}
+
+/*
+ * Write the transmissions at every rate, and the frames they delivered, of
+ * each class in every replication of scenario s
+ */
+static void
+batch_rates (const batch_t *batch, int s)
+{
+    const scenario_t *sc = &batch->scenarios[s];
+    const result_t *res;
+    int r, c, k;
+    FILE *fp;
+
+    fp = batch_open(batch, s, sc->rate_output,
+                    "scenario,replication,class,mbps,attempts,delivered");
+    for (r = 0; r < sc->replications; r++) {
+        res = &batch->results[sc->first_job + r];
+        for (c = 0; c < sc->cfg.class_count; c++) {
+            for (k = 0; k < MAX_RATES; k++) {
+                fprintf(fp, "%s,%d,%d,%g,%d,%d\n", sc->name, r, c,
+                        rate_mbps[k], res->rate_attempts[c][k],
+                        res->rate_delivered[c][k]);
+            }
+        }
+    }
+    fclose(fp);
+}
+
+/*
+ * Write the idle, successful and collided trigger cycles of every RU in
+ * every replication of scenario s
+ */
+static void
+batch_rus (const batch_t *batch, int s)
+{
+    const scenario_t *sc = &batch->scenarios[s];
+    const result_t *res;
+    int r, k;
+    FILE *fp;
+
+    fp = batch_open(batch, s, sc->ru_output,
+                    "scenario,replication,ru,idle,success,collision");
+    for (r = 0; r < sc->replications; r++) {
+        res = &batch->results[sc->first_job + r];
+        for (k = 0; k < sc->cfg.ru_count; k++) {
+            fprintf(fp, "%s,%d,%d,%d,%d,%d\n", sc->name, r, k,
+                    res->triggers - res->ru_success[k] - res->ru_collision[k],
+                    res->ru_success[k], res->ru_collision[k]);
+        }
+    }
+    fclose(fp);
+}
+
+/*
+ * Write the time each class of every replication of scenario s spent in
+ * each energy state, the energy it drew and the energy per delivered bit
+ */
+static void
+batch_energy (const batch_t *batch, int s)
+{
+    const scenario_t *sc = &batch->scenarios[s];
+    const result_t *res;
+    double joules;
+    int r, c;
+    FILE *fp;
+
+    fp = batch_open(batch, s, sc->energy_output,
+                    "scenario,replication,class,tx,rx,idle,sleep,joules,"
+                    "delivered,nj_per_bit");
+    for (r = 0; r < sc->replications; r++) {
+        res = &batch->results[sc->first_job + r];
+        for (c = 0; c < sc->cfg.class_count; c++) {
+            joules = energy_joules(&sc->cfg, res->energy[c]);
+            fprintf(fp, "%s,%d,%d,%.0f,%.0f,%.0f,%.0f,%f,%d,%f\n", sc->name,
+                    r, c, res->energy[c][ENERGY_TX], res->energy[c][ENERGY_RX],
+                    res->energy[c][ENERGY_IDLE],
+                    res->energy[c][ENERGY_SLEEP], joules, res->delivered[c],
+                    res->delivered[c] ? joules * 1e9 / res->delivered[c] /
+                                        sc->cfg.frame_bits : 0.0);
+        }
+    }
+    fclose(fp);
+}
+
+/*
+ * Write the uplink and downlink traffic of every replication of scenario s
+ */
+static void
+batch_flows (const batch_t *batch, int s)
+{
+    static const char *direction[FLOWS] = { "uplink", "downlink" };
+    const scenario_t *sc = &batch->scenarios[s];
+    const result_t *res;
+    const flow_t *fl;
+    int r, k;
+    FILE *fp;
+
+    fp = batch_open(batch, s, sc->flow_output,
+                    "scenario,replication,direction,packets,throughput,"
+                    "delay,arrivals,drops");
+    for (r = 0; r < sc->replications; r++) {
+        res = &batch->results[sc->first_job + r];
+        for (k = 0; k < FLOWS; k++) {
+            fl = &res->flows[k];
+            fprintf(fp, "%s,%d,%s,%d,%f,%f,%d,%d\n", sc->name, r,
+                    direction[k], fl->packets, (double)fl->packets / res->slots,
+                    fl->packets ? fl->delay_sum / fl->packets : 0.0,
+                    fl->arrivals, fl->drops);
+        }
+    }
+    fclose(fp);
+}
+
+/*
+ * Write the links of the topology of every replication of scenario s, and
+ * how the nodes fared on it
+ */
+static void
+batch_topology (const batch_t *batch, int s)
+{
+    const scenario_t *sc = &batch->scenarios[s];
+    const result_t *res;
+    int r;
+    FILE *fp;
+
+    fp = batch_open(batch, s, sc->topology_output,
+                    "scenario,replication,hear_links,one_way,reach_links,"
+                    "deferrals,exposed,fairness");
+    for (r = 0; r < sc->replications; r++) {
+        res = &batch->results[sc->first_job + r];
+        fprintf(fp, "%s,%d,%d,%d,%d,%d,%d,%f\n", sc->name, r,
+                res->hear_links, res->one_way, res->reach_links,
+                res->deferrals, res->exposed, res->fairness);
+    }
+    fclose(fp);
+}
+
+/*
+ * Write the rare-event estimates of every replication of scenario s
+ */
+static void
+batch_rare (const batch_t *batch, int s)
+{
+    const scenario_t *sc = &batch->scenarios[s];
+    const result_t *res;
+    double est[4];
+    int r;
+    FILE *fp;
+
+    fp = batch_open(batch, s, sc->rare_output,
+                    "scenario,replication,samples,paths,packets,drop,"
+                    "drop_error,drop_plain,starve,starve_error,starve_plain");
+    for (r = 0; r < sc->replications; r++) {
+        res = &batch->results[sc->first_job + r];
+        rare_estimate(&res->rare, est);
+        fprintf(fp, "%s,%d,%d,%d,%d,%e,%f,%e,%e,%f,%e\n", sc->name, r,
+                res->rare.samples, res->rare.paths, res->rare.packets,
+                est[0], est[1],
+                res->rare.packets ?
+                (double)res->rare.drops / res->rare.packets : 0.0,
+                est[2], est[3],
+                res->rare.packets ?
+                (double)res->rare.starved / res->rare.packets : 0.0);
+    }
+    fclose(fp);
+}
+
+/*
+ * Print the mean and the standard deviation of the efficiency and the
+ * throughput of every scenario, and write the replications to the output
+ * files. A file named by several scenarios gets all their rows.
+ */
+static void
+batch_report (const batch_t *batch)
+{
+    const scenario_t *sc;
+    const result_t *res;
+    double eff, thr, eff_sum, eff_sq, thr_sum, thr_sq, n;
+    int s, r, failed;
+    FILE *fp;
+
+    for (s = 0; s < batch->scenario_count; s++) {
+        sc = &batch->scenarios[s];
+        fp = NULL;
+        if (sc->output[0] != '\0') {
+            fp = batch_open(batch, s, sc->output,
+                            "scenario,replication,seed,slots,idle,"
+                            "transmission,collision,packets,lost,efficiency,"
+                            "throughput,converged");
+        }
+        if (sc->window_output[0] != '\0' && sc->cfg.window > 0) {
+            batch_windows(batch, s, 0);
+        }
+        if (sc->phase_output[0] != '\0' && sc->cfg.load_count > 0) {
+            batch_windows(batch, s, 1);
+        }
+        if (sc->rate_output[0] != '\0' &&
+            sc->cfg.rate_control != RATE_NONE) {
+            batch_rates(batch, s);
+        }
+        if (sc->ru_output[0] != '\0' && sc->cfg.ru_count > 0) {
+            batch_rus(batch, s);
+        }
+        if (sc->energy_output[0] != '\0') {
+            batch_energy(batch, s);
+        }
+        if (sc->flow_output[0] != '\0' && sc->cfg.ap_class >= 0) {
+            batch_flows(batch, s);
+        }
+        if (sc->topology_output[0] != '\0' &&
+            sc->cfg.topology != TOPO_SHARED) {
+            batch_topology(batch, s);
+        }
+        if (sc->rare_output[0] != '\0' && config_rare(&sc->cfg)) {
+            batch_rare(batch, s);
+        }
+
+        eff_sum = eff_sq = thr_sum = thr_sq = 0.0;
+        failed = 0;
+        for (r = 0; r < sc->replications; r++) {
+            res = &batch->results[sc->first_job + r];
+            eff = (double)res->transmission_slots / res->slots /
+                  ((sc->cfg.ru_count > 0) ? sc->cfg.ru_count : 1);
+            thr = (double)res->packet_count / res->slots;
+            if (sc->cfg.markov || sc->cfg.mean_field) {
+                eff = res->model_efficiency;
+                thr = res->model_throughput;
+            }
+            eff_sum += eff;
+            eff_sq += eff * eff;
+            thr_sum += thr;
+            thr_sq += thr * thr;
+            failed += !res->converged;
+
+            if (fp != NULL) {
+                fprintf(fp, "%s,%d,%u,%d,%d,%d,%d,%d,%d,%f,%f,%d\n",
+                        sc->name, r, sc->cfg.seed + r, res->slots,
+                        res->idle_slots, res->transmission_slots,
+                        res->collision_slots, res->packet_count,
+                        res->lost_frames, eff, thr, res->converged);
+            }
+        }
+        if (fp != NULL) {
+            fclose(fp);
+        }
+
+        n = sc->replications;
+        printf("%s: %d runs, efficiency %f +/- %f, throughput %f +/- %f",
+               sc->name, sc->replications, eff_sum / n,
+               (n > 1) ? sqrt(fmax(0.0, (eff_sq - eff_sum * eff_sum / n) /
+                                        (n - 1))) : 0.0,
+               thr_sum / n,
+               (n > 1) ? sqrt(fmax(0.0, (thr_sq - thr_sum * thr_sum / n) /
+                                        (n - 1))) : 0.0);
+        if (failed > 0) {
+            printf(", %d failed to converge", failed);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Run every replication of the scenarios on a pool of worker threads. Each
+ * worker keeps one arena for all of its runs, so after its first run it
+ * only allocates when it meets a bigger scenario. Results are reported in
+ * scenario order once every job is done, whatever the thread count.
+ */
+static void
+batch_run (arena_t *arena, scenario_t *scenarios, int scenario_count,
+           int thread_count)
+{
+    const config_t *cfg;
+    batch_t batch;
+    worker_t *workers;
+    int s, j, w;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.scenarios = scenarios;
+    batch.scenario_count = scenario_count;
+    for (s = 0; s < scenario_count; s++) {
+        scenarios[s].first_job = batch.job_count;
+        batch.job_count += scenarios[s].replications;
+    }
+
+    if (thread_count > batch.job_count) {
+        thread_count = batch.job_count;
+    }
+
+    batch.results = arena_alloc(arena, batch.job_count * sizeof(result_t));
+    memset(batch.results, 0, batch.job_count * sizeof(result_t));
+    for (s = 0; s < scenario_count; s++) {
+        cfg = &scenarios[s].cfg;
+        for (j = scenarios[s].first_job;
+             j < scenarios[s].first_job + scenarios[s].replications; j++) {
+            if (cfg->window > 0) {
+                batch.results[j].windows =
+                    arena_alloc(arena, (cfg->slot_size / cfg->window + 1) *
+                                       sizeof(window_t));
+            }
+            if (cfg->load_count > 0) {
+                batch.results[j].phases =
+                    arena_alloc(arena, (cfg->load_count + 1) *
+                                       sizeof(window_t));
+            }
+        }
+    }
+    workers = arena_alloc(arena, thread_count * sizeof(worker_t));
+    memset(workers, 0, thread_count * sizeof(worker_t));
+
+    for (w = 0; w < thread_count; w++) {
+        workers[w].batch = &batch;
+        workers[w].index = w;
+        pthread_create(&workers[w].thread, NULL, batch_thread, &workers[w]);
+    }
+    for (w = 0; w < thread_count; w++) {
+        pthread_join(workers[w].thread, NULL);
+        arena_free(&workers[w].arena);
+    }
+
+    batch_report(&batch);
+}
+
+/*
+ * Print the share of the transmissions of each class at every rate, and the
+ * frames per transmission they delivered, then those of every node if
+ * nodes is set
+ */
+static void
+rate_print (const sim_t *sim, int nodes)
+{
+    const config_t *cfg = sim->cfg;
+    const link_t *link;
+    int c, r, j, total;
+
+    for (c = 0; c < cfg->class_count; c++) {
+        total = 0;
+        for (r = 0; r < MAX_RATES; r++) {
+            total += sim->rate_attempts[c][r];
+        }
+        printf("Class %d rates:", c);
+        for (r = 0; r < MAX_RATES; r++) {
+            if (sim->rate_attempts[c][r] > 0) {
+                printf(" %gM %.1f%% (%.2f)", rate_mbps[r],
+                       100.0 * sim->rate_attempts[c][r] / total,
+                       (double)sim->rate_delivered[c][r] /
+                       sim->rate_attempts[c][r]);
+            }
+        }
+        printf("\n");
+    }
+
+    for (j = 0; nodes && j < sim->node_count; j++) {
+        link = &sim->links[j];
+        printf("Node %d: class %d, SNR %.1f dB, now %gM, delivered %d,"
+               " attempts", j, sim_class_of(sim, j), link->snr,
+               rate_mbps[link->rate], link->delivered);
+        for (r = 0; r < MAX_RATES; r++) {
+            printf(" %d", link->attempts[r]);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Print how many nodes each beacon woke, how long they took to fetch their
+ * downlink frames and how much of the bursts of contention after the
+ * beacons went to collisions
+ */
+static void
+ps_print (const sim_t *sim)
+{
+    printf("Nodes woken per beacon: %f mean, %d max\n",
+           sim->beacons ? (double)sim->woken / sim->beacons : 0.0,
+           sim->max_woken);
+    printf("PS-Polls: %d, %f slots after the beacon, %d downlink drops\n",
+           sim->polls, sim->polls ? sim->poll_delay / sim->polls : 0.0,
+           sim->dl_drops);
+    printf("Post-beacon bursts: %f slots, %f%% collisions\n",
+           sim->bursts_closed ? sim->burst_slots / sim->bursts_closed : 0.0,
+           sim->burst_slots > 0.0 ?
+           100.0 * sim->burst_collisions / sim->burst_slots : 0.0);
+}
+
+/*
+ * Print the energy drawn by each class and by all nodes together, per
+ * delivered bit as well, then that of every node if nodes is set
+ */
+static void
+energy_print (const sim_t *sim, int nodes)
+{
+    const config_t *cfg = sim->cfg;
+    double slots[ENERGY_STATES], joules, total = 0.0;
+    int c, j, delivered, total_delivered = 0;
+
+    for (c = 0; c < cfg->class_count; c++) {
+        delivered = sim_energy_class(sim, c, slots);
+        joules = energy_joules(cfg, slots);
+        printf("Class %d energy: %f J, %.2f nJ/bit (tx %.0f, rx %.0f, "
+               "idle %.0f, sleep %.0f slots)\n", c, joules,
+               delivered ? joules * 1e9 / delivered / cfg->frame_bits : 0.0,
+               slots[ENERGY_TX], slots[ENERGY_RX], slots[ENERGY_IDLE],
+               slots[ENERGY_SLEEP]);
+        total += joules;
+        total_delivered += delivered;
+    }
+    printf("Energy: %f J, %.2f nJ/bit\n", total,
+           total_delivered ? total * 1e9 / total_delivered / cfg->frame_bits :
+                             0.0);
+
+    for (j = 0; nodes && j < sim->node_count; j++) {
+        sim_energy(sim, j, slots);
+        joules = energy_joules(cfg, slots);
+        printf("Node %d: %f J, %.2f nJ/bit, %d delivered (tx %.0f, rx %.0f, "
+               "idle %.0f, sleep %.0f slots)\n", j, joules,
+               sim->energy[j].delivered ? joules * 1e9 /
+               sim->energy[j].delivered / cfg->frame_bits : 0.0,
+               sim->energy[j].delivered, slots[ENERGY_TX], slots[ENERGY_RX],
+               slots[ENERGY_IDLE], slots[ENERGY_SLEEP]);
+    }
+}
+
+/*
+ * Print the throughput and the delay of the uplink and the downlink, over
+ * the slots of the run
+ */
+static void
+flow_print (const sim_t *sim, int slots)
+{
+    static const char *direction[FLOWS] = { "Uplink", "Downlink" };
+    flow_t flows[FLOWS];
+    int k;
+
+    sim_flows(sim, flows);
+    for (k = 0; k < FLOWS; k++) {
+        printf("%s: %d packets, throughput %f, delay %.1f, "
+               "%d arrivals, %d drops\n", direction[k], flows[k].packets,
+               (double)flows[k].packets / slots,
+               flows[k].packets ? flows[k].delay_sum / flows[k].packets : 0.0,
+               flows[k].arrivals, flows[k].drops);
+    }
+    printf("AP queue: %d packets\n",
+           sim->queues[sim->node_count - 1].length);
+}
+
+/*
+ * Print the size of the Markov chain and the efficiency it gives, which is
+ * exact for a CW that stops doubling at max_stage
+ */
+static void
+markov_print (const sim_t *sim)
+{
+    printf("Markov chain: %d states, %d transitions, %d iterations\n",
+           sim->markov_states, sim->markov_transitions,
+           sim->markov_iterations);
+    printf("Exact efficiency (CW capped at stage %d): %.9f, throughput "
+           "%.9f\n", sim->cfg->max_stage, sim->model_efficiency,
+           sim->model_throughput);
+}
+
+/*
+ * Print the efficiency of the mean field, over the horizon and in its last
+ * step, and the share of the nodes of each class at each stage by then.
+ * Unlike the Markov chain, the CW doubles up to MAX_BACKOFF_CW, as in the
+ * shared engine.
+ */
+static void
+meanfield_print (const sim_t *sim)
+{
+    const config_t *cfg = sim->cfg;
+    int c, s, last;
+
+    printf("Mean field: %d steps, %d stages (CW capped at %d)\n",
+           sim->meanfield_steps, sim->meanfield_stages, MAX_BACKOFF_CW);
+    printf("Mean-field efficiency: %.9f, throughput %.9f, last step %.9f",
+           sim->model_efficiency, sim->model_throughput,
+           sim->meanfield_final);
+    if (sim->meanfield_drift <= MEANFIELD_TOLERANCE) {
+        printf(" (fixed point)\n");
+    } else {
+        printf(" (still moving by %.2g a step)\n", sim->meanfield_drift);
+    }
+    for (c = 0; c < cfg->class_count; c++) {
+        for (last = MAX_BACKOFF_STAGE - 1;
+             last > 0 && sim->stage_share[c][last] < MEANFIELD_MIN_SHARE;
+             last--);
+        printf("Class %d stages:", c);
+        for (s = 0; s <= last; s++) {
+            printf(" %.4f", fmax(sim->stage_share[c][s], 0.0));
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Print the odds of a drop and of starvation, from the clones and from
+ * the packets of the run
+ */
+static void
+rare_print (const sim_t *sim)
+{
+    const config_t *cfg = sim->cfg;
+    const rare_t *rare = &sim->rare;
+    double est[4];
+
+    rare_estimate(rare, est);
+    if (cfg->split > 0) {
+        printf("Rare events: %d clones split into %d copies, %d packets "
+               "of node 0\n", rare->samples, rare->paths, rare->packets);
+    } else {
+        printf("Rare events: %d clones, %d packets of node 0, tilt %.3f\n",
+               rare->samples, rare->packets, cfg->tilt);
+    }
+    if (cfg->retry_limit > 0) {
+        printf("Drop after %d collisions: %.6e (relative error %.4f), "
+               "plain %d of %d\n", cfg->retry_limit, est[0], est[1],
+               rare->drops, rare->packets);
+    }
+    if (cfg->starve_slots > 0) {
+        printf("Starvation for %d slots: %.6e (relative error %.4f), "
+               "plain %d of %d\n", cfg->starve_slots, est[2], est[3],
+               rare->starved, rare->packets);
+    }
+}
+
+/*
+ * Print the links of the topology and how the nodes fared on it
+ */
+static void
+topo_print (const sim_t *sim)
+{
+    printf("Topology: %d sensing links (%d one-way), %d interference links\n",
+           sim->hear_links, sim->one_way, sim->reach_links);
+    printf("Deferrals: %d, %d exposed (%f%%)\n", sim->deferrals,
+           sim->exposed,
+           sim->deferrals ? 100.0 * sim->exposed / sim->deferrals : 0.0);
+    printf("Fairness: %f\n", sim->fairness);
+}
+
+/*
+ * Print the outcomes of the trigger cycles on every RU
+ */
+static void
+uora_print (const sim_t *sim)
+{
+    int r;
+
+    printf("Trigger frames: %d\n", sim->triggers);
+    for (r = 0; r < sim->cfg->ru_count; r++) {
+        printf("RU %d: idle %d, success %d, collision %d\n", r,
+               sim->triggers - sim->ru_success[r] - sim->ru_collision[r],
+               sim->ru_success[r], sim->ru_collision[r]);
+    }
+}
+
+static void
+usage (void)
+{
+    printf("syntax: ./Simulation <pkt-size> <node-count> <cw-size> [options]\n"
+           "  -S, --slots <n>        slot horizon (default %d)\n"
+           "  -f, --fixed            run the full horizon instead of stopping\n"
+           "                         once the efficiency converges\n"
+           "  -b, --policy <name>    backoff policy: double (default), or\n"
+           "                         reset to the initial CW on success\n"
+           "  -s, --seed <n>         random seed (default: time)\n"
+           "  -p, --parareal <n>     run the horizon as n parallel segments\n"
+           "  -t, --tolerance <x>    parareal boundary tolerance (default %.2f)\n"
+           "  -i, --iterations <n>   parareal correction passes (default n)\n"
+           "  -a, --approx           use the p-persistent approximation\n"
+           "  -c, --compare          compare approximate and exact engines\n"
+           "                         over the full slot horizon\n"
+           "      --markov <n>       solve the Markov chain of the nodes\n"
+           "                         exactly, with the CW doubling up to\n"
+           "                         stage n\n"
+           "      --mean-field       iterate the mean-field dynamics of\n"
+           "                         the nodes; with -c, compare them\n"
+           "                         with the exact engine\n"
+           "      --pin              pin worker threads to CPUs\n"
+           "      --bench-startup <n>\n"
+           "                         time to first slot, averaged over n runs\n"
+           "\n"
+           "       ./Simulation --config <file> [options]\n"
+           "      --config <file>    run the scenarios of an INI file\n"
+           "      --threads <n>      worker threads for the scenario runs\n"
+           "                         (default: one per CPU)\n"
+           "      --window <n>       report statistics every n slots\n"
+           "      --load <x>         offered load in packets per node and\n"
+           "                         slot (default: saturated)\n"
+           "      --ampdu <n>        aggregate up to n frames per A-MPDU\n"
+           "      --amsdu <n>        aggregate up to n frames per A-MSDU\n"
+           "      --subframe-error <p>\n"
+           "                         loss probability of each (sub)frame\n"
+           "      --txop <n>         TXOP limit in slots\n"
+           "      --rate-control <name>\n"
+           "                         none (default), fixed, arf, aarf or\n"
+           "                         minstrel\n"
+           "      --snr <dB>         link SNR of every node (default %.0f)\n"
+           "      --rate-stats       print the rates used by every node\n"
+           "      --uora <n>         802.11ax OFDMA random access on n RUs\n"
+           "                         per trigger frame\n"
+           "      --energy           print the energy drawn by each class\n"
+           "      --energy-stats     and by every node\n"
+           "      --beacon <n>       AP beacon every n slots\n"
+           "      --ssids <n>        beacons per interval (default 1)\n"
+           "      --probe-rate <x>   AP probe exchanges per slot\n"
+           "      --power-save       nodes doze between beacons, with\n"
+           "                         --beacon and --load\n"
+           "      --dl-rate <x>      power save downlink frames per node\n"
+           "                         and slot\n"
+           "      --ap-load <x>      AP downlink frames per node and slot,\n"
+           "                         with uplink traffic from --load\n"
+           "      --topology <x>     geometric topology in a square of side x\n"
+           "                         ranges\n"
+           "      --range-spread <x> node ranges uniform in [1 - x, 1]\n"
+           "      --retry-limit <n>  estimate the odds of a packet of node 0\n"
+           "                         colliding n times\n"
+           "      --starve <n>       and of it waiting n slots to go out\n"
+           "      --tilt <x>         how many times likelier a backoff of\n"
+           "                         another node is to hit node 0 in the\n"
+           "                         clones (default %.1f)\n"
+           "      --split <n>        split the clones into n copies at\n"
+           "                         each further collision or wait\n"
+           "                         level instead of tilting them\n"
+           "\n"
+           "Scenario file keys, given per [name] section or before the first\n"
+           "section as defaults:\n"
+           "  pkt_size, node_count, cw_size, policy = double|reset,\n"
+           "  class = <node-count> <cw-size> (repeatable, in place of\n"
+           "  node_count and cw_size),\n"
+           "  engine = exact|approx|markov|meanfield, max_stage, slots,\n"
+           "  stop = converge|fixed, replications, seed, output = <csv file>,\n"
+           "  join|leave = <slot> <node-count> [<class>] (repeatable),\n"
+           "  birth_rate = <nodes per slot>, death_rate = <per node per slot>,\n"
+           "  max_nodes, window = <slots>, window_output = <csv file>,\n"
+           "  load = <slot> <packets per node and slot> [<class>] and\n"
+           "  ramp = <start> <end> <from> <to> <steps> [<class>] (repeatable),\n"
+           "  queue_limit, phase_output = <csv file>,\n"
+           "  aggregation = none|ampdu|amsdu, agg_frames, agg_slots,\n"
+           "  subframe_slots, subframe_error, txop = <slots>, sifs_slots,\n"
+           "  rate_control = none|fixed|arf|aarf|minstrel, fixed_rate = <Mbps>,\n"
+           "  snr = <dB> [<class>], snr_spread = <dB>, rate_output = <csv file>,\n"
+           "  ru_count, ocw_max, trigger_slots, ru_output = <csv file>,\n"
+           "  tx_power, rx_power, idle_power, sleep_power = <W>,\n"
+           "  slot_time = <us>, frame_bits, energy_output = <csv file>,\n"
+           "  beacon_interval = <slots>, beacon_slots, ssid_count,\n"
+           "  probe_rate = <exchanges per slot>, probe_slots,\n"
+           "  power_save = on|off, dl_rate = <frames per node and slot>,\n"
+           "  ap_load = <frames per node and slot>, ap_cw, ap_queue,\n"
+           "  flow_output = <csv file>, topology = shared|geometric|links,\n"
+           "  area = <ranges>, range_spread, link_distance = <ranges>,\n"
+           "  hears|reaches = <node> <node>... (repeatable),\n"
+           "  topology_output = <csv file>, retry_limit, starve_slots, tilt,\n"
+           "  split, rare_output = <csv file>\n",
+           MAX_SLOT_SIZE, DEFAULT_TOLERANCE, DEFAULT_SNR, DEFAULT_TILT);
+}
+
+/*
+ * Main entry point
+ */
+int
+main (int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "slots",      required_argument, NULL, 'S' },
+        { "fixed",      no_argument,       NULL, 'f' },
+        { "policy",     required_argument, NULL, 'b' },
+        { "seed",       required_argument, NULL, 's' },
+        { "parareal",   required_argument, NULL, 'p' },
+        { "tolerance",  required_argument, NULL, 't' },
+        { "iterations", required_argument, NULL, 'i' },
+        { "approx",     no_argument,       NULL, 'a' },
+        { "compare",    no_argument,       NULL, 'c' },
+        { "pin",        no_argument,       NULL, 'P' },
+        { "bench-startup", required_argument, NULL, 'B' },
+        { "config",     required_argument, NULL, 'C' },
+        { "threads",    required_argument, NULL, 'T' },
+        { "window",     required_argument, NULL, 'w' },
+        { "load",       required_argument, NULL, 'l' },
+        { "ampdu",      required_argument, NULL, 'M' },
+        { "amsdu",      required_argument, NULL, 'm' },
+        { "subframe-error", required_argument, NULL, 'e' },
+        { "txop",       required_argument, NULL, 'x' },
+        { "rate-control", required_argument, NULL, 'R' },
+        { "snr",        required_argument, NULL, 'N' },
+        { "rate-stats", no_argument,       NULL, 'r' },
+        { "uora",       required_argument, NULL, 'u' },
+        { "energy",     no_argument,       NULL, 'E' },
+        { "energy-stats", no_argument,     NULL, 'n' },
+        { "beacon",     required_argument, NULL, 'W' },
+        { "ssids",      required_argument, NULL, 'I' },
+        { "probe-rate", required_argument, NULL, 'o' },
+        { "power-save", no_argument,       NULL, 'Z' },
+        { "dl-rate",    required_argument, NULL, 'D' },
+        { "ap-load",    required_argument, NULL, 'A' },
+        { "topology",   required_argument, NULL, 'G' },
+        { "markov",     required_argument, NULL, 'K' },
+        { "mean-field", no_argument,       NULL, 'F' },
+        { "retry-limit", required_argument, NULL, 'y' },
+        { "starve",     required_argument, NULL, 'v' },
+        { "tilt",       required_argument, NULL, 'k' },
+        { "split",      required_argument, NULL, 'X' },
+        { "range-spread", required_argument, NULL, 'g' },
+        { NULL,         0,                 NULL, 0 }
+    };
+    arena_t arena = { NULL, NULL };
+    sim_t sim;
+    scenario_t *scenarios;
+    const char *config_file = NULL;
+    int opt, i, iterations = 0, corrections = 0, bench_runs = 0;
+    int scenario_count, thread_count, rate_stats = 0, energy_stats = 0;
+    double load = -1.0;
+
+    /*
+     * Slot size can be infinite. For this program, we will assume that it
+     * can't exceed one million slots unless asked otherwise.
+     */
+    config.slot_size = MAX_SLOT_SIZE;
+    config.tolerance = DEFAULT_TOLERANCE;
+    config.queue_limit = DEFAULT_QUEUE_LIMIT;
+    config.agg_frames = MAX_AGG_FRAMES;
+    config.fixed_rate = MAX_RATES - 1;
+    config.ocw_max = DEFAULT_OCW_MAX;
+    config.trigger_slots = DEFAULT_TRIGGER_SLOTS;
+    config.power[ENERGY_TX] = DEFAULT_TX_POWER;
+    config.power[ENERGY_RX] = DEFAULT_RX_POWER;
+    config.power[ENERGY_IDLE] = DEFAULT_IDLE_POWER;
+    config.power[ENERGY_SLEEP] = DEFAULT_SLEEP_POWER;
+    config.slot_time = DEFAULT_SLOT_TIME;
+    config.frame_bits = DEFAULT_FRAME_BITS;
+    config.beacon_slots = DEFAULT_BEACON_SLOTS;
+    config.ssid_count = 1;
+    config.probe_slots = DEFAULT_PROBE_SLOTS;
+    config.ap_queue = DEFAULT_AP_QUEUE;
+    config.link_distance = DEFAULT_LINK_DISTANCE;
+    config.tilt = DEFAULT_TILT;
+    for (i = 0; i < MAX_NODE_CLASSES; i++) {
+        config.snr[i] = DEFAULT_SNR;
+    }
+
+    /* Initialize the random seed generator */
+    config.seed = time(NULL);
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+        CPU_ZERO(&cpus);
+    }
+    thread_count = CPU_COUNT(&cpus) > 0 ? CPU_COUNT(&cpus) : 1;
+
+    while ((opt = getopt_long(argc, argv, "S:fb:s:p:t:i:ac", long_options,
+                              NULL)) != -1) {
+        switch (opt) {
+            case 'S':
+                config.slot_size = atoi(optarg);
+                break;
+            case 'f':
+                config.fixed = 1;
+                break;
+            case 'b':
+                if (parse_policy(optarg, &config.policy) != 0) {
+                    usage();
+                    exit(0);
+                }
+                break;
+            case 's':
+                config.seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                config.segment_count = atoi(optarg);
+                break;
+            case 't':
+                config.tolerance = atof(optarg);
+                break;
+            case 'i':
+                config.max_iterations = atoi(optarg);
+                break;
+            case 'a':
+                config.approx = 1;
+                break;
+            case 'c':
+                config.compare = 1;
+                break;
+            case 'P':
+                config.pin = 1;
+                break;
+            case 'B':
+                bench_runs = atoi(optarg);
+                break;
+            case 'C':
+                config_file = optarg;
+                break;
+            case 'T':
+                thread_count = atoi(optarg);
+                break;
+            case 'w':
+                config.window = atoi(optarg);
+                break;
+            case 'l':
+                load = atof(optarg);
+                break;
+            case 'M':
+            case 'm':
+                config.aggregation = (opt == 'M') ? AGG_AMPDU : AGG_AMSDU;
+                config.agg_frames = atoi(optarg);
+                break;
+            case 'e':
+                config.subframe_error = atof(optarg);
+                break;
+            case 'x':
+                config.txop_slots = atoi(optarg);
+                break;
+            case 'R':
+                if (parse_rate_control(optarg, &config.rate_control) != 0) {
+                    usage();
+                    exit(0);
+                }
+                break;
+            case 'N':
+                for (i = 0; i < MAX_NODE_CLASSES; i++) {
+                    config.snr[i] = atof(optarg);
+                }
+                break;
+            case 'r':
+                rate_stats = 1;
+                break;
+            case 'u':
+                config.ru_count = atoi(optarg);
+                break;
+            case 'n':
+                energy_stats = 1;
+                /* Fall through */
+            case 'E':
+                config.energy = 1;
+                break;
+            case 'W':
+                config.beacon_interval = atoi(optarg);
+                break;
+            case 'I':
+                config.ssid_count = atoi(optarg);
+                break;
+            case 'o':
+                config.probe_rate = atof(optarg);
+                break;
+            case 'Z':
+                config.power_save = 1;
+                break;
+            case 'D':
+                config.dl_rate = atof(optarg);
+                break;
+            case 'A':
+                config.ap_load = atof(optarg);
+                break;
+            case 'G':
+                config.topology = TOPO_GEOMETRIC;
+                config.area = atof(optarg);
+                break;
+            case 'g':
+                config.range_spread = atof(optarg);
+                break;
+            case 'K':
+                config.markov = 1;
+                config.max_stage = atoi(optarg);
+                break;
+            case 'F':
+                config.mean_field = 1;
+                break;
+            case 'y':
+                config.retry_limit = atoi(optarg);
+                break;
+            case 'v':
+                config.starve_slots = atoi(optarg);
+                break;
+            case 'k':
+                config.tilt = atof(optarg);
+                break;
+            case 'X':
+                config.split = atoi(optarg);
+                break;
+            default:
+                usage();
+                exit(0);
+        }
+    }
+
+    /*
+     * A scenario file replaces the positional arguments. The other options
+     * become defaults for its scenarios.
+     */
+    if (config_file != NULL) {
+        if (argc != optind || thread_count < 1 || config.segment_count > 0 ||
+            config.compare || bench_runs > 0) {
+            usage();
+            exit(0);
+        }
+        scenarios = arena_alloc(&arena, MAX_SCENARIOS * sizeof(scenario_t));
+        scenario_count = scenario_load(config_file, &config, &arena,
+                                       scenarios);
+        batch_run(&arena, scenarios, scenario_count, thread_count);
+        arena_free(&arena);
+        return 0;
+    }
+
+    if (argc - optind != 3) {
+        usage();
+        exit(0);
+    }
+
+    /* Validate the inputs */
+    config.pkt_size = atoi(argv[optind]);
+    config.node_count = atoi(argv[optind + 1]);
+    config.cw_size = atoi(argv[optind + 2]);
+    config_finish(&config);
+    if (load >= 0.0) {
+        config_load(&config, 0, load, 0);
+    }
+
+    if (!config_valid(&config)) {
+        printf("Error taking inputs!\n");
+        exit(1);
+    }
+
+    if (bench_runs > 0) {
+        bench_startup(&config, &arena, bench_runs);
+        arena_free(&arena);
+        return 0;
+    }
+
+    if (config.compare) {
+        approx_compare(&config, &arena);
+        arena_free(&arena);
+        return 0;
+    }
+
+    if (config.segment_count > 0) {
+        if (config.max_iterations == 0) {
+            config.max_iterations = config.segment_count;
+        }
+        iterations = parareal_run(&config, &arena, &sim, &corrections);
+        i = sim.slot;
+    } else {
+        i = run_once(&config, &arena, &sim);
+
+        if (i < 0) {
+            printf("Markov chain has over %d states or %d transitions!\n",
+                   MAX_MARKOV_STATES, MAX_MARKOV_TRANSITIONS);
+            exit(1);
+        }
+        if (i >= config.slot_size && !config.fixed && !config.markov &&
+            !config.mean_field && !config_rare(&config)) {
+            /*
+             * For some reason, our simulation didn't converge. Complain and
+             * bail.
+             */
+            printf("Simulation failed to converge. Exiting...\n");
+            exit(1);
+        }
+    }
+
+    printf("Idle Slots: %d\n", sim.idle_slots);
+    printf("Transmission Slots: %d\n", sim.transmission_slots);
+    printf("Collision Slots: %d\n", sim.collision_slots);
+    if (config.beacon_interval > 0 || config.probe_rate > 0.0) {
+        printf("Management Slots: %d (%d beacons)\n", sim.mgmt_slots,
+               sim.beacons);
+    }
+    printf("Packets successfully transmitted: %d\n", sim.packet_count);
+    if (sim.bursts) {
+        printf("Frames lost: %d\n", sim.lost_frames);
+    }
+    if (config.txop_slots > 0) {
+        printf("Transmissions per TXOP: %f\n",
+               sim.txops ? (double)sim.transmissions / sim.txops : 0.0);
+        printf("SIFS Slots: %d\n", sim.gap_slots);
+    }
+    if (config.ru_count > 0) {
+        uora_print(&sim);
+    }
+    printf("Total slots used for simulation: %d\n", i);
+    if (config.segment_count > 0) {
+        printf("Parareal segments: %d, passes: %d, corrections: %d\n",
+               config.segment_count, iterations, corrections);
+    }
+
+    printf("Throughput: %f\n", (float)sim.packet_count / (float)i);
+    printf(" %d %f\n", config.cw_size, (float)sim.transmission_slots / (float)i /
+           ((config.ru_count > 0) ? config.ru_count : 1));
+
+    window_print("Window", sim.windows, sim.window_count,
+                 config.load_count == 0);
+    window_print("Phase", sim.phases, sim.phase_count, 0);
+    if (config.rate_control != RATE_NONE) {
+        rate_print(&sim, rate_stats);
+    }
+    if (config.power_save) {
+        ps_print(&sim);
+    }
+    if (config.ap_class >= 0) {
+        flow_print(&sim, i);
+    }
+    if (config.topology != TOPO_SHARED) {
+        topo_print(&sim);
+    }
+    if (config.markov) {
+        markov_print(&sim);
+    }
+    if (config.mean_field) {
+        meanfield_print(&sim);
+    }
+    if (config_rare(&config)) {
+        rare_print(&sim);
+    }
+    if (config.energy) {
+        energy_print(&sim, energy_stats);
+    }
 
+    arena_free(&arena);
     return 0;
 }
 